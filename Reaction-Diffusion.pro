@@ -22,23 +22,69 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
-CONFIG += c++11
+CONFIG += c++11 thread
+
+# the solver loops rely on auto-vectorization
+QMAKE_CXXFLAGS_RELEASE -= -O2
+QMAKE_CXXFLAGS_RELEASE += -O3
+
+# native reaction kernels are loaded with dlopen
+unix: LIBS += -ldl
+
+# qmake CONFIG+=fftw uses the system FFTW for the spectral integrator
+# instead of the bundled transforms
+fftw {
+    DEFINES += HAVE_FFTW
+    LIBS += -lfftw3
+}
+
+# qmake CONFIG+=mpi builds with the MPI compiler wrappers, the field is
+# then split over the ranks of mpirun -np N ./Reaction-Diffusion
+mpi {
+    DEFINES += HAVE_MPI
+    QMAKE_CXX = mpicxx
+    QMAKE_LINK = mpicxx
+    SOURCES += distributedsolver.cpp
+    HEADERS += distributedsolver.h
+}
 
 SOURCES += \
+    ensemble.cpp \
+    etd.cpp \
+    exprderivative.cpp \
+    exprprogram.cpp \
+    fft.cpp \
     glwidget.cpp \
+    jit.cpp \
+    kernels.cpp \
     main.cpp \
     mainwindow.cpp \
+    multigrid.cpp \
     rdwidget.cpp \
+    reactions.cpp \
     solver.cpp \
+    threadpool.cpp \
     tinyexpr.c \
     openglwindow.cpp \
     surface.cpp
 
 HEADERS += \
+    block.h \
+    ensemble.h \
+    etd.h \
+    exprderivative.h \
+    exprprogram.h \
+    fft.h \
     glwidget.h \
+    jit.h \
+    kernels.h \
     mainwindow.h \
+    multigrid.h \
     rdwidget.h \
+    reactions.h \
     solver.h \
+    threadpool.h \
+    tridiagonal.h \
     tinyexpr.h \
     openglwindow.h \
     matrix.h \
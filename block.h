@@ -0,0 +1,44 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "matrix.h"
+
+// A block of a field that is split between several solvers, each of them
+// running one block. The explicit steps of a solver given a block take
+// the ghost cells on its shared edges from the neighbouring blocks, the
+// boundary condition only applies on the edges of the whole field
+class Block
+{
+public:
+    enum Edge
+    {
+        EdgeTop,
+        EdgeBottom,
+        EdgeLeft,
+        EdgeRight
+    };
+
+    virtual ~Block() {}
+
+    // cells per row and number of rows of the whole field, ghost cells
+    // included
+    virtual int fieldWidth() const = 0;
+    virtual int fieldHeight() const = 0;
+    // field row and column of the cell (0, 0) of the block
+    virtual int top() const = 0;
+    virtual int left() const = 0;
+    // another block lies across the edge, or the block itself when the
+    // field wraps around
+    virtual bool isShared(Edge edge) const = 0;
+
+    // Starts sending the cells along the shared edges of u and v and
+    // receiving the ghost cells there: the ghost columns of the interior
+    // rows, or whole ghost rows, corners included. finish() waits for the
+    // exchange started last and stores the ghost cells
+    virtual void start(Matrix<double> &u, Matrix<double> &v, bool rows) = 0;
+    virtual void start(Matrix<float> &u, Matrix<float> &v, bool rows) = 0;
+    virtual void finish(Matrix<double> &u, Matrix<double> &v) = 0;
+    virtual void finish(Matrix<float> &u, Matrix<float> &v) = 0;
+};
+
+#endif // BLOCK_H
@@ -0,0 +1,570 @@
+#include "distributedsolver.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+
+using namespace std;
+
+// values of the settings of the leading solver sent with every call
+static const int SETTINGS = 10;
+
+template<class T> static MPI_Datatype mpiType();
+template<> MPI_Datatype mpiType<double>() { return MPI_DOUBLE; }
+template<> MPI_Datatype mpiType<float>() { return MPI_FLOAT; }
+
+static Block::Edge opposite(Block::Edge edge)
+{
+    switch(edge)
+    {
+    case Block::EdgeTop:
+        return Block::EdgeBottom;
+    case Block::EdgeBottom:
+        return Block::EdgeTop;
+    case Block::EdgeLeft:
+        return Block::EdgeRight;
+    default:
+        return Block::EdgeLeft;
+    }
+}
+
+DistributedSolver::DistributedSolver(MPI_Comm comm) :
+    m_comm(comm), m_rank(0), m_ranks(1), m_leading(false), m_width(0), m_height(0),
+    m_blockRows(1), m_blockColumns(1), m_row(0), m_column(0), m_top(0), m_left(0), m_rows(false),
+    m_rateMax(numeric_limits<double>::infinity()), m_rateL2(numeric_limits<double>::infinity())
+{
+    MPI_Comm_rank(comm, &m_rank);
+    MPI_Comm_size(comm, &m_ranks);
+    m_solver.setBlock(this);
+}
+
+DistributedSolver::~DistributedSolver()
+{
+    quit();
+}
+
+Solver *DistributedSolver::solver()
+{
+    return &m_solver;
+}
+
+int DistributedSolver::rank() const
+{
+    return m_rank;
+}
+
+int DistributedSolver::ranks() const
+{
+    return m_ranks;
+}
+
+void DistributedSolver::setSize(int width, int height)
+{
+    if(!partition(width, height))
+        return;
+
+    announce(CommandSize);
+
+    int top, left, rows, cols;
+    extent(m_rank, top, left, rows, cols);
+    m_solver.setSize(cols + 2, rows + 2);
+}
+
+void DistributedSolver::solve(int steps)
+{
+    announce(CommandSolve, steps);
+
+    // all the blocks step with the same dt, the one given to
+    // setTimeStep() when no block finds a bound
+    double fraction = m_solver.autoTimeStep();
+    if(fraction > 0)
+    {
+        double limit = m_solver.stableTimeStep();
+        MPI_Allreduce(MPI_IN_PLACE, &limit, 1, MPI_DOUBLE, MPI_MIN, m_comm);
+        m_solver.setAutoTimeStep(0);
+        m_solver.dt = isfinite(limit) ? fraction * limit : m_solver.timeStep();
+        m_solver.solve(steps);
+        m_solver.setAutoTimeStep(fraction);
+    }
+    else
+        m_solver.solve(steps);
+
+    // the root mean square weighs every block by its cells
+    double cells = (double)(m_solver.height - 2) * (m_solver.width - 2);
+    double l2 = m_solver.rate(RateNormL2);
+    double squares = l2 * l2 * cells;
+    m_rateMax = m_solver.rate(RateNormMax);
+    MPI_Allreduce(MPI_IN_PLACE, &m_rateMax, 1, MPI_DOUBLE, MPI_MAX, m_comm);
+    MPI_Allreduce(MPI_IN_PLACE, &squares, 1, MPI_DOUBLE, MPI_SUM, m_comm);
+    m_rateL2 = sqrt(squares / ((double)(m_height - 2) * (m_width - 2)));
+
+    // MPI_MAX may drop the NaN of a block that diverged, the sum keeps it
+    if(isnan(squares))
+        m_rateMax = squares;
+}
+
+double DistributedSolver::rate(RateNorm norm) const
+{
+    return norm == RateNormL2 ? m_rateL2 : m_rateMax;
+}
+
+// a field that diverged has no finite rate and never counts as steady
+bool DistributedSolver::isSteady() const
+{
+    double tolerance = m_solver.steadyTolerance(), r = rate(m_solver.steadyNorm());
+    return tolerance > 0 && isfinite(r) && r < tolerance;
+}
+
+void DistributedSolver::updateLimits()
+{
+    announce(CommandLimits);
+
+    m_solver.updateLimits();
+    double limits[] = {m_solver.maxu, m_solver.maxv, -m_solver.minu, -m_solver.minv};
+    MPI_Allreduce(MPI_IN_PLACE, limits, 4, MPI_DOUBLE, MPI_MAX, m_comm);
+    m_solver.maxu = limits[0];
+    m_solver.maxv = limits[1];
+    m_solver.minu = -limits[2];
+    m_solver.minv = -limits[3];
+}
+
+void DistributedSolver::gather(Matrix<double> &u)
+{
+    announce(CommandGather);
+
+    int top, left, rows, cols;
+    extent(m_rank, top, left, rows, cols);
+    vector<double> cells(rows * cols);
+    for(int i = 0; i < rows; i++)
+        for(int j = 0; j < cols; j++)
+            cells[i * cols + j] = m_solver.value(i + 1, j + 1);
+
+    // blocks one after the other in rank order
+    vector<int> counts(m_ranks), offsets(m_ranks);
+    for(int r = 0, offset = 0; r < m_ranks; r++)
+    {
+        int t, l, m, n;
+        extent(r, t, l, m, n);
+        counts[r] = m * n;
+        offsets[r] = offset;
+        offset += m * n;
+    }
+
+    vector<double> field(m_rank == 0 ? (m_height - 2) * (m_width - 2) : 0);
+    MPI_Gatherv(cells.data(), rows * cols, MPI_DOUBLE, field.data(), counts.data(), offsets.data(),
+                MPI_DOUBLE, 0, m_comm);
+    if(m_rank != 0)
+        return;
+
+    int m = m_height, n = m_width;
+    u = Matrix<double>(m, n);
+    for(int r = 0; r < m_ranks; r++)
+    {
+        extent(r, top, left, rows, cols);
+        const double *block = field.data() + offsets[r];
+        for(int i = 0; i < rows; i++)
+            copy(block + i * cols, block + (i + 1) * cols, u.row(top + 1 + i) + left + 1);
+    }
+
+    for(int i = 1; i < m - 1; i++)
+    {
+        u(i,0) = u(i,1);
+        u(i,n - 1) = u(i,n - 2);
+    }
+    copy(u.row(1), u.row(1) + n, u.row(0));
+    copy(u.row(m - 2), u.row(m - 2) + n, u.row(m - 1));
+}
+
+void DistributedSolver::lead()
+{
+    m_leading = m_rank == 0;
+}
+
+void DistributedSolver::serve()
+{
+    if(m_rank == 0)
+        return;
+
+    for(;;)
+    {
+        int header[3], length;
+        double settings[SETTINGS];
+        MPI_Bcast(header, 3, MPI_INT, 0, m_comm);
+        MPI_Bcast(settings, SETTINGS, MPI_DOUBLE, 0, m_comm);
+        MPI_Bcast(&length, 1, MPI_INT, 0, m_comm);
+        string model(length, ' ');
+        MPI_Bcast(&model[0], length, MPI_CHAR, 0, m_comm);
+
+        if(header[2])
+        {
+            int sizes[2];
+            MPI_Bcast(sizes, 2, MPI_INT, 0, m_comm);
+            string names(sizes[0], ' ');
+            vector<double> fields(sizes[1]);
+            MPI_Bcast(&names[0], sizes[0], MPI_CHAR, 0, m_comm);
+            MPI_Bcast(fields.data(), sizes[1], MPI_DOUBLE, 0, m_comm);
+            m_fieldNames = names;
+            m_fields = fields;
+        }
+
+        if(header[0] == CommandQuit)
+            return;
+
+        follow(settings, model);
+        if(header[2])
+            followFields(m_fieldNames, m_fields);
+        switch(header[0])
+        {
+        case CommandSize:
+            setSize((int)settings[0], (int)settings[1]);
+            break;
+        case CommandSolve:
+            solve(header[1]);
+            break;
+        case CommandLimits:
+            updateLimits();
+            break;
+        case CommandGather:
+        {
+            Matrix<double> u;
+            gather(u);
+            break;
+        }
+        }
+    }
+}
+
+void DistributedSolver::quit()
+{
+    announce(CommandQuit);
+    m_leading = false;
+}
+
+// sends the call to the following ranks, with the settings they need to
+// make it in the same way
+void DistributedSolver::announce(Command command, int steps)
+{
+    if(!m_leading)
+        return;
+
+    // the parameter fields only go out when they changed
+    string names;
+    vector<double> fields;
+    packFields(m_solver, names, fields);
+    bool changed = names != m_fieldNames || fields != m_fields;
+    if(changed)
+    {
+        m_fieldNames = names;
+        m_fields = fields;
+    }
+
+    int header[] = {command, steps, changed};
+    double settings[SETTINGS] = {
+        (double)m_width, (double)m_height, m_solver.dt, (double)m_solver.precision(),
+        (double)m_solver.boundaryCondition(), m_solver.boundaryU(), m_solver.boundaryV(),
+        m_solver.autoTimeStep(), (double)m_solver.nativeKernels(), m_solver.timeStep()
+    };
+    string model = packModel(m_solver.model());
+    int length = model.size();
+
+    MPI_Bcast(header, 3, MPI_INT, 0, m_comm);
+    MPI_Bcast(settings, SETTINGS, MPI_DOUBLE, 0, m_comm);
+    MPI_Bcast(&length, 1, MPI_INT, 0, m_comm);
+    MPI_Bcast(&model[0], length, MPI_CHAR, 0, m_comm);
+
+    if(changed)
+    {
+        int sizes[] = {(int)m_fieldNames.size(), (int)m_fields.size()};
+        MPI_Bcast(sizes, 2, MPI_INT, 0, m_comm);
+        MPI_Bcast(&m_fieldNames[0], sizes[0], MPI_CHAR, 0, m_comm);
+        MPI_Bcast(m_fields.data(), sizes[1], MPI_DOUBLE, 0, m_comm);
+    }
+}
+
+// takes the settings of the leading solver, the model is only compiled
+// again when it changed
+void DistributedSolver::follow(const double *settings, const string &model)
+{
+    // dt of the last step and the one given to setTimeStep(), which the
+    // automatic mode falls back on
+    m_solver.setTimeStep(settings[9]);
+    m_solver.dt = settings[2];
+    m_solver.setPrecision((Precision)(int)settings[3]);
+    if(m_solver.boundaryCondition() != (BoundaryCondition)(int)settings[4] ||
+       m_solver.boundaryU() != settings[5] || m_solver.boundaryV() != settings[6])
+        m_solver.setBoundaryCondition((BoundaryCondition)(int)settings[4], settings[5], settings[6]);
+    m_solver.setAutoTimeStep(settings[7]);
+    m_solver.setNativeKernels(settings[8] != 0);
+
+    if(model != m_model)
+    {
+        m_model = model;
+        m_solver.setModel(unpackModel(model));
+    }
+}
+
+// binds the parameter fields of the leading solver, and only those
+void DistributedSolver::followFields(const string &names, const vector<double> &fields)
+{
+    m_solver.clearParamFields();
+
+    istringstream in(names);
+    string name;
+    size_t k = 0;
+    while(getline(in, name))
+    {
+        Matrix<double> source((int)fields[k], (int)fields[k + 1]);
+        k += 2;
+        for(int i = 0; i < source.rows; i++, k += source.cols)
+            copy(fields.begin() + k, fields.begin() + k + source.cols, source.row(i));
+        m_solver.setParamField(name, source);
+    }
+}
+
+// Blocks down and across with the shortest edges per block, every block
+// gets at least one interior row and column. The same on every rank
+bool DistributedSolver::partition(int width, int height)
+{
+    int rows = height - 2, cols = width - 2;
+    int best = 0;
+    double edges = 0;
+    for(int p = 1; p <= m_ranks; p++)
+    {
+        int q = m_ranks / p;
+        if(p * q != m_ranks || p > rows || q > cols)
+            continue;
+
+        double e = (double)rows / p + (double)cols / q;
+        if(best == 0 || e < edges)
+        {
+            best = p;
+            edges = e;
+        }
+    }
+    if(best == 0)
+        return false;
+
+    m_width = width;
+    m_height = height;
+    m_blockRows = best;
+    m_blockColumns = m_ranks / best;
+    m_row = m_rank / m_blockColumns;
+    m_column = m_rank % m_blockColumns;
+
+    int r, c;
+    extent(m_rank, m_top, m_left, r, c);
+    return true;
+}
+
+// field row and column of the cell (0, 0) of the block of a rank, and its
+// interior rows and columns
+void DistributedSolver::extent(int rank, int &top, int &left, int &rows, int &cols) const
+{
+    int row = rank / m_blockColumns, column = rank % m_blockColumns;
+    int interiorRows = m_height - 2, interiorCols = m_width - 2;
+
+    top = row * interiorRows / m_blockRows;
+    left = column * interiorCols / m_blockColumns;
+    rows = (row + 1) * interiorRows / m_blockRows - top;
+    cols = (column + 1) * interiorCols / m_blockColumns - left;
+}
+
+// rank of the block across the edge, the grid of blocks wraps around
+int DistributedSolver::neighbour(Edge edge) const
+{
+    int row = m_row, column = m_column;
+    if(edge == EdgeTop)
+        row = (row + m_blockRows - 1) % m_blockRows;
+    else if(edge == EdgeBottom)
+        row = (row + 1) % m_blockRows;
+    else if(edge == EdgeLeft)
+        column = (column + m_blockColumns - 1) % m_blockColumns;
+    else
+        column = (column + 1) % m_blockColumns;
+
+    return row * m_blockColumns + column;
+}
+
+int DistributedSolver::fieldWidth() const
+{
+    return m_width;
+}
+
+int DistributedSolver::fieldHeight() const
+{
+    return m_height;
+}
+
+int DistributedSolver::top() const
+{
+    return m_top;
+}
+
+int DistributedSolver::left() const
+{
+    return m_left;
+}
+
+bool DistributedSolver::isShared(Edge edge) const
+{
+    bool border = (edge == EdgeTop && m_row == 0) || (edge == EdgeBottom && m_row == m_blockRows - 1) ||
+                  (edge == EdgeLeft && m_column == 0) || (edge == EdgeRight && m_column == m_blockColumns - 1);
+    return !border || m_solver.boundaryCondition() == BoundaryPeriodic;
+}
+
+void DistributedSolver::start(Matrix<double> &u, Matrix<double> &v, bool rows)
+{
+    startExchange(u, v, rows);
+}
+
+void DistributedSolver::start(Matrix<float> &u, Matrix<float> &v, bool rows)
+{
+    startExchange(u, v, rows);
+}
+
+void DistributedSolver::finish(Matrix<double> &u, Matrix<double> &v)
+{
+    finishExchange(u, v);
+}
+
+void DistributedSolver::finish(Matrix<float> &u, Matrix<float> &v)
+{
+    finishExchange(u, v);
+}
+
+// One message per shared edge holds the cells of u and then of v. It is
+// tagged with the edge it leaves through, the receiving rank expects the
+// opposite of the edge it arrives at
+template<class T>
+void DistributedSolver::startExchange(Matrix<T> &u, Matrix<T> &v, bool rows)
+{
+    int m = u.rows, n = u.cols;
+    int count = rows ? n : m - 2;
+    Edge edges[2] = {rows ? EdgeTop : EdgeLeft, rows ? EdgeBottom : EdgeRight};
+
+    m_rows = rows;
+    m_requests.clear();
+    for(Edge edge : edges)
+    {
+        if(!isShared(edge))
+            continue;
+
+        // buffers of doubles also hold floats
+        m_send[edge].resize(2 * count);
+        m_receive[edge].resize(2 * count);
+        T *send = reinterpret_cast<T*>(m_send[edge].data());
+
+        if(rows)
+        {
+            int i = edge == EdgeTop ? 1 : m - 2;
+            copy(u.row(i), u.row(i) + n, send);
+            copy(v.row(i), v.row(i) + n, send + n);
+        }
+        else
+        {
+            int j = edge == EdgeLeft ? 1 : n - 2;
+            for(int i = 1; i < m - 1; i++)
+            {
+                send[i - 1] = u(i,j);
+                send[count + i - 1] = v(i,j);
+            }
+        }
+
+        MPI_Request receive, sent;
+        MPI_Irecv(m_receive[edge].data(), 2 * count, mpiType<T>(), neighbour(edge), opposite(edge), m_comm, &receive);
+        MPI_Isend(send, 2 * count, mpiType<T>(), neighbour(edge), edge, m_comm, &sent);
+        m_requests.push_back(receive);
+        m_requests.push_back(sent);
+    }
+}
+
+template<class T>
+void DistributedSolver::finishExchange(Matrix<T> &u, Matrix<T> &v)
+{
+    MPI_Waitall(m_requests.size(), m_requests.data(), MPI_STATUSES_IGNORE);
+    m_requests.clear();
+
+    int m = u.rows, n = u.cols;
+    int count = m_rows ? n : m - 2;
+    Edge edges[2] = {m_rows ? EdgeTop : EdgeLeft, m_rows ? EdgeBottom : EdgeRight};
+    for(Edge edge : edges)
+    {
+        if(!isShared(edge))
+            continue;
+
+        const T *receive = reinterpret_cast<const T*>(m_receive[edge].data());
+        if(m_rows)
+        {
+            int i = edge == EdgeTop ? 0 : m - 1;
+            copy(receive, receive + n, u.row(i));
+            copy(receive + n, receive + 2 * n, v.row(i));
+        }
+        else
+        {
+            int j = edge == EdgeLeft ? 0 : n - 1;
+            for(int i = 1; i < m - 1; i++)
+            {
+                u(i,j) = receive[i - 1];
+                v(i,j) = receive[count + i - 1];
+            }
+        }
+    }
+}
+
+string DistributedSolver::packModel(const Model &model)
+{
+    ostringstream out;
+    out.precision(17);
+    out << model.params.size() << '\n';
+    for(const auto &param : model.params)
+        out << param.first << ' ' << param.second.min << ' ' << param.second.max << ' ' << param.second.value << '\n';
+    out << model.fu << '\n' << model.fv << '\n' << model.species.size() << '\n';
+    for(const Species &s : model.species)
+        out << s.name << '\n' << s.f << '\n';
+    return out.str();
+}
+
+// the parameter fields of solver as the leading rank sends them
+void DistributedSolver::packFields(const Solver &solver, string &names, vector<double> &fields)
+{
+    for(const string &name : solver.paramFields())
+    {
+        const Matrix<double> &source = solver.paramField(name);
+        names += name + '\n';
+        fields.push_back(source.rows);
+        fields.push_back(source.cols);
+        for(int i = 0; i < source.rows; i++)
+            fields.insert(fields.end(), source.row(i), source.row(i) + source.cols);
+    }
+}
+
+Model DistributedSolver::unpackModel(const string &text)
+{
+    istringstream in(text);
+    Model model;
+    size_t count = 0;
+
+    in >> count;
+    for(size_t k = 0; k < count; k++)
+    {
+        string name;
+        Param param;
+        in >> name >> param.min >> param.max >> param.value;
+        model.params[name] = param;
+    }
+    in.ignore(numeric_limits<streamsize>::max(), '\n');
+    getline(in, model.fu);
+    getline(in, model.fv);
+
+    in >> count;
+    in.ignore(numeric_limits<streamsize>::max(), '\n');
+    for(size_t k = 0; k < count; k++)
+    {
+        Species s;
+        getline(in, s.name);
+        getline(in, s.f);
+        model.species.push_back(s);
+    }
+    return model;
+}
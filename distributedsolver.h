@@ -0,0 +1,111 @@
+#ifndef DISTRIBUTEDSOLVER_H
+#define DISTRIBUTEDSOLVER_H
+
+#include <mpi.h>
+
+#include <string>
+#include <vector>
+
+#include "solver.h"
+#include "block.h"
+
+// Field split in a grid of blocks over the ranks of an MPI communicator,
+// every rank steps its own block with a Solver. The cells along the edges
+// of the blocks go to the neighbouring ranks with nonblocking messages
+// while the inside of the blocks is computed. Only explicit steps of
+// planes of two species are supported.
+// All the ranks make the same calls in the same order. Instead, rank 0
+// can lead() the others, which then follow its calls in serve()
+class DistributedSolver : public Block
+{
+public:
+    explicit DistributedSolver(MPI_Comm comm = MPI_COMM_WORLD);
+    ~DistributedSolver();
+
+    // solver of the block of this rank, set up like a solver of the whole
+    // field. Its limits are the ones of the whole field
+    Solver *solver();
+    int rank() const;
+    int ranks() const;
+
+    // cells per row and number of rows of the whole field, the ghost
+    // cells included. Splits it in blocks and inits them, sizes with
+    // fewer interior cells than ranks along both sides are ignored
+    void setSize(int width, int height);
+    // advances every block by steps time steps, with the smallest dt of
+    // all the blocks when the time step is automatic
+    void solve(int steps = 1);
+    // rate of change of the whole field in the last solve()
+    double rate(RateNorm norm = RateNormMax) const;
+    bool isSteady() const;
+    // limits of the whole field from the limits of the blocks, the
+    // percentiles are the widest ones of the blocks
+    void updateLimits();
+    // u of the whole field on rank 0, the ghost cells copy the edge cells
+    void gather(Matrix<double> &u);
+
+    // the calls of rank 0 are announced to the other ranks along with the
+    // settings of its solver, until quit()
+    void lead();
+    // follows the calls of the leading rank until it quits
+    void serve();
+    void quit();
+
+    int fieldWidth() const override;
+    int fieldHeight() const override;
+    int top() const override;
+    int left() const override;
+    bool isShared(Edge edge) const override;
+    void start(Matrix<double> &u, Matrix<double> &v, bool rows) override;
+    void start(Matrix<float> &u, Matrix<float> &v, bool rows) override;
+    void finish(Matrix<double> &u, Matrix<double> &v) override;
+    void finish(Matrix<float> &u, Matrix<float> &v) override;
+
+private:
+    enum Command
+    {
+        CommandSize,
+        CommandSolve,
+        CommandLimits,
+        CommandGather,
+        CommandQuit
+    };
+
+    void announce(Command command, int steps = 0);
+    void follow(const double *settings, const std::string &model);
+    void followFields(const std::string &names, const std::vector<double> &fields);
+    bool partition(int width, int height);
+    void extent(int rank, int &top, int &left, int &rows, int &cols) const;
+    int neighbour(Edge edge) const;
+    template<class T> void startExchange(Matrix<T> &u, Matrix<T> &v, bool rows);
+    template<class T> void finishExchange(Matrix<T> &u, Matrix<T> &v);
+
+    static std::string packModel(const Model &model);
+    static void packFields(const Solver &solver, std::string &names, std::vector<double> &fields);
+    static Model unpackModel(const std::string &text);
+
+    MPI_Comm m_comm;
+    int m_rank, m_ranks;
+    bool m_leading;
+    // size of the field, blocks down and across, and the block of this
+    // rank in the grid of blocks
+    int m_width, m_height;
+    int m_blockRows, m_blockColumns;
+    int m_row, m_column;
+    int m_top, m_left;
+    // edge cells sent and ghost cells received across every edge, of
+    // whichever scalar type the fields have
+    std::vector<double> m_send[4], m_receive[4];
+    std::vector<MPI_Request> m_requests;
+    bool m_rows;
+    double m_rateMax, m_rateL2;
+    // model last received from the leading rank, and the parameter fields
+    // last sent or received: the names one per line, and the rows, columns
+    // and entries of every source
+    std::string m_model;
+    std::string m_fieldNames;
+    std::vector<double> m_fields;
+    Solver m_solver;
+};
+
+#endif // DISTRIBUTEDSOLVER_H
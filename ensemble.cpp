@@ -0,0 +1,99 @@
+#include "ensemble.h"
+
+using namespace std;
+
+Ensemble::Ensemble(int threads) :
+    m_pool(threads)
+{
+
+}
+
+Solver *Ensemble::prototype()
+{
+    return &m_prototype;
+}
+
+int Ensemble::addMember(const map<string, double> &values)
+{
+    const Solver &p = m_prototype;
+
+    Model model = p.model();
+    for(const auto &value : values)
+    {
+        auto param = model.params.find(value.first);
+        if(param != model.params.end())
+            param->second.value = value.second;
+    }
+
+    // the pool of the ensemble is the only source of threads
+    Solver *s = new Solver();
+    s->setThreadCount(1);
+    s->setSimdLevel(p.simdLevel());
+    s->setPrecision(p.precision());
+    s->setIntegrator(p.integrator());
+    s->setDiffusionStage(p.splitDiffusion(), p.diffusionSteps());
+    s->setReactionStage(p.splitReaction(), p.reactionSteps());
+    s->setTolerance(p.tolerance());
+    s->setActiveTolerance(p.activeTolerance());
+    s->setBoundaryCondition(p.boundaryCondition(), p.boundaryU(), p.boundaryV());
+    s->setNormalization(p.normalization());
+    s->setSteadyTolerance(p.steadyTolerance(), p.steadyNorm());
+    s->setAutoTimeStep(p.autoTimeStep());
+    s->setNativeKernels(p.nativeKernels());
+    s->setDimensions(p.dimensions());
+    s->setTimeStep(p.dt);
+
+    // bound before the model so that the compiled terms of the prototype,
+    // which read the same fields, are shared
+    for(const string &name : p.paramFields())
+        s->setParamField(name, p.paramField(name));
+    s->setModel(model, p);
+    s->setSize(p.width, p.height);
+
+    m_members.push_back(unique_ptr<Solver>(s));
+    return m_members.size() - 1;
+}
+
+void Ensemble::clear()
+{
+    m_members.clear();
+}
+
+int Ensemble::size() const
+{
+    return m_members.size();
+}
+
+Solver *Ensemble::member(int index)
+{
+    return m_members[index].get();
+}
+
+void Ensemble::setThreadCount(int threads)
+{
+    m_pool.setSize(threads);
+}
+
+int Ensemble::threadCount() const
+{
+    return m_pool.size();
+}
+
+void Ensemble::solve(int steps)
+{
+    // members are handed out one at a time, in order
+    m_pool.run(m_members.size(), [this, steps](int index, int) {
+        Solver *s = m_members[index].get();
+        if(!s->isSteady())
+            s->solve(steps);
+    });
+}
+
+int Ensemble::steadyCount() const
+{
+    int count = 0;
+    for(const auto &s : m_members)
+        if(s->isSteady())
+            count++;
+    return count;
+}
@@ -0,0 +1,49 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "solver.h"
+#include "threadpool.h"
+
+// Independent runs of one model with different parameter values, for
+// parameter sweeps in one process. The prototype compiles the model once
+// and the members reuse its compiled terms and native kernel. Every member
+// steps on a single thread, and a thread that is done with a member takes
+// the next one, so members of different cost keep all the threads busy
+class Ensemble
+{
+public:
+    explicit Ensemble(int threads = 1);
+
+    // solver of the model, members take its size, time step, precision,
+    // integrator, split stages and their substeps, parameter fields,
+    // tolerances, boundary condition, normalization, SIMD level and native
+    // kernels when they are added
+    Solver *prototype();
+
+    // adds a run of the model of the prototype with the parameters in
+    // values changed, returns its index
+    int addMember(const std::map<std::string, double> &values);
+    void clear();
+    int size() const;
+    Solver *member(int index);
+
+    void setThreadCount(int threads);
+    int threadCount() const;
+
+    // advances every member that is not steady yet by steps time steps
+    void solve(int steps = 1);
+    // members whose state is steady
+    int steadyCount() const;
+
+private:
+    Solver m_prototype;
+    std::vector<std::unique_ptr<Solver>> m_members;
+    ThreadPool m_pool;
+};
+
+#endif // ENSEMBLE_H
@@ -0,0 +1,202 @@
+#include "etd.h"
+
+#include <cmath>
+#include <complex>
+
+using namespace std;
+
+static const double PI = 3.14159265358979323846;
+
+// points of the contour integral of the phi functions
+static const int CONTOUR_POINTS = 32;
+// transpose block, in elements
+static const int BLOCK = 32;
+
+Dct2D::Dct2D() : m_rows(0), m_cols(0)
+{
+}
+
+void Dct2D::setSize(int rows, int cols)
+{
+    m_rows = rows;
+    m_cols = cols;
+    m_dctRows.setSize(cols);
+    m_dctCols.setSize(rows);
+    m_a.resize((size_t)rows * cols);
+    m_b.resize((size_t)rows * cols);
+}
+
+int Dct2D::rows() const
+{
+    return m_rows;
+}
+
+int Dct2D::cols() const
+{
+    return m_cols;
+}
+
+template<class T>
+void Dct2D::forward(const Matrix<T> &w, double *spectrum, ThreadPool &pool)
+{
+    int rows = m_rows, cols = m_cols;
+    pool.run(rows, [this, &w, cols](int i, int) {
+        const T *src = w.row(i + 1) + 1;
+        double *dst = m_a.data() + (size_t)i * cols;
+        for(int j = 0; j < cols; j++)
+            dst[j] = src[j];
+    });
+
+    lines(m_dctRows, rows, m_a.data(), m_b.data(), true, pool);
+    transpose(m_b.data(), m_a.data(), rows, cols, pool);
+    lines(m_dctCols, cols, m_a.data(), spectrum, true, pool);
+}
+
+template<class T>
+void Dct2D::inverse(const double *spectrum, Matrix<T> &w, ThreadPool &pool)
+{
+    int rows = m_rows, cols = m_cols;
+    lines(m_dctCols, cols, spectrum, m_a.data(), false, pool);
+    transpose(m_a.data(), m_b.data(), cols, rows, pool);
+    lines(m_dctRows, rows, m_b.data(), m_a.data(), false, pool);
+
+    pool.run(rows, [this, &w, cols](int i, int) {
+        const double *src = m_a.data() + (size_t)i * cols;
+        T *dst = w.row(i + 1) + 1;
+        for(int j = 0; j < cols; j++)
+            dst[j] = src[j];
+    });
+}
+
+void Dct2D::lines(const Dct &dct, int n, const double *in, double *out, bool forward, ThreadPool &pool)
+{
+    // lines are transformed two at a time
+    int length = dct.size(), pairs = (n + 1) / 2;
+    m_scratch.resize(pool.size());
+
+    pool.run(pairs, [this, &dct, in, out, n, length, forward](int pair, int thread) {
+        int i = 2 * pair;
+        const double *x0 = in + (size_t)i * length, *x1 = i + 1 < n ? x0 + length : nullptr;
+        double *y0 = out + (size_t)i * length, *y1 = x1 ? y0 + length : nullptr;
+        if(forward)
+            dct.forward(x0, x1, y0, y1, m_scratch[thread]);
+        else
+            dct.inverse(x0, x1, y0, y1, m_scratch[thread]);
+    });
+}
+
+void Dct2D::transpose(const double *in, double *out, int rows, int cols, ThreadPool &pool)
+{
+    int blocks = (rows + BLOCK - 1) / BLOCK;
+
+    pool.run(blocks, [in, out, rows, cols](int bi, int) {
+        for(int bj = 0; bj < cols; bj += BLOCK)
+            for(int i = bi * BLOCK; i < min(rows, (bi + 1) * BLOCK); i++)
+                for(int j = bj; j < min(cols, bj + BLOCK); j++)
+                    out[(size_t)j * rows + i] = in[(size_t)i * cols + j];
+    });
+}
+
+template void Dct2D::forward<double>(const Matrix<double> &, double *, ThreadPool &);
+template void Dct2D::forward<float>(const Matrix<float> &, double *, ThreadPool &);
+template void Dct2D::inverse<double>(const double *, Matrix<double> &, ThreadPool &);
+template void Dct2D::inverse<float>(const double *, Matrix<float> &, ThreadPool &);
+
+// eigenvalues of the 5-point second difference of n cells with zero flux
+// ends
+static vector<double> eigenvalues(int n, double h)
+{
+    vector<double> lambda(n);
+    for(int k = 0; k < n; k++)
+    {
+        double s = sin(PI * k / (2.0 * n));
+        lambda[k] = -4 * s * s / (h * h);
+    }
+    return lambda;
+}
+
+void EtdCoefficients::compute(int rows, int cols, double h, double dt, double d)
+{
+    // k1 runs along the columns, k2 along the rows
+    vector<double> lambda1 = eigenvalues(cols, h), lambda2 = eigenvalues(rows, h);
+
+    // exp(r) and exp(r / 2) on the contour z + r factor into a real
+    // exponential of z and constants
+    complex<double> r[CONTOUR_POINTS], er[CONTOUR_POINTS], er2[CONTOUR_POINTS];
+    for(int m = 0; m < CONTOUR_POINTS; m++)
+    {
+        r[m] = polar(1.0, PI * (m + 0.5) / CONTOUR_POINTS);
+        er[m] = exp(r[m]);
+        er2[m] = exp(r[m] * 0.5);
+    }
+
+    size_t count = (size_t)rows * cols;
+    e.resize(count); e2.resize(count); q.resize(count);
+    f1.resize(count); f2.resize(count); f3.resize(count);
+
+    for(int k1 = 0; k1 < cols; k1++)
+    {
+        for(int k2 = 0; k2 < rows; k2++)
+        {
+            size_t idx = (size_t)k1 * rows + k2;
+            double z = dt * d * (lambda1[k1] + lambda2[k2]);
+            double ez = exp(z), ez2 = exp(z / 2);
+
+            complex<double> sq, s1, s2, s3;
+            for(int m = 0; m < CONTOUR_POINTS; m++)
+            {
+                complex<double> x = z + r[m], x3 = x * x * x;
+                complex<double> ex = ez * er[m];
+                sq += (ez2 * er2[m] - 1.0) / x;
+                s1 += (-4.0 - x + ex * (4.0 - 3.0 * x + x * x)) / x3;
+                s2 += (2.0 + x + ex * (x - 2.0)) / x3;
+                s3 += (-4.0 - 3.0 * x - x * x + ex * (4.0 - x)) / x3;
+            }
+
+            // the circle is symmetric about the real axis, so the mean over
+            // its upper half is the real part
+            e[idx] = ez;
+            e2[idx] = ez2;
+            q[idx] = dt * sq.real() / CONTOUR_POINTS;
+            f1[idx] = dt * s1.real() / CONTOUR_POINTS;
+            f2[idx] = dt * s2.real() / CONTOUR_POINTS;
+            f3[idx] = dt * s3.real() / CONTOUR_POINTS;
+        }
+    }
+}
+
+Etd::Etd() : m_width(0), m_height(0), m_dt(0), m_du(0), m_dv(0)
+{
+}
+
+bool Etd::prepare(int width, int height, double dt, double du, double dv)
+{
+    if(width == m_width && height == m_height && dt == m_dt && du == m_du && dv == m_dv)
+        return false;
+
+    m_width = width;
+    m_height = height;
+    m_dt = dt;
+    m_du = du;
+    m_dv = dv;
+
+    int rows = height - 2, cols = width - 2;
+    double h = 2.0f / (width - 1);
+
+    dct.setSize(rows, cols);
+    u.compute(rows, cols, h, dt, du);
+    v.compute(rows, cols, h, dt, dv);
+
+    size_t count = (size_t)rows * cols;
+    for(int s = 0; s < 2; s++)
+    {
+        state[s].resize(count);
+        n0[s].resize(count);
+        na[s].resize(count);
+        nb[s].resize(count);
+        nc[s].resize(count);
+        stage[s].resize(count);
+    }
+
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef ETD_H
+#define ETD_H
+
+#include <vector>
+
+#include "fft.h"
+#include "matrix.h"
+#include "threadpool.h"
+
+// 2D cosine transform of the interior cells [1, rows] x [1, cols] of a
+// field. The spectrum is stored transposed, spectrum[k1 * rows + k2] where
+// k1 runs along the columns of the field: the ETD factors are computed in
+// the same order, so the final transposition is not needed
+class Dct2D
+{
+public:
+    Dct2D();
+
+    void setSize(int rows, int cols);
+    int rows() const;
+    int cols() const;
+
+    template<class T> void forward(const Matrix<T> &w, double *spectrum, ThreadPool &pool);
+    template<class T> void inverse(const double *spectrum, Matrix<T> &w, ThreadPool &pool);
+
+private:
+    // transforms the n lines of length dct.size() of in
+    void lines(const Dct &dct, int n, const double *in, double *out, bool forward, ThreadPool &pool);
+    // in is rows x cols
+    static void transpose(const double *in, double *out, int rows, int cols, ThreadPool &pool);
+
+    int m_rows, m_cols;
+    // along the rows and along the columns
+    Dct m_dctRows, m_dctCols;
+    std::vector<double> m_a, m_b;
+    // per thread
+    std::vector<FftScratch> m_scratch;
+};
+
+// ETD-RK4 factors of one species for every wavenumber pair, following Cox
+// and Matthews. The phi functions are evaluated as means over a circle
+// around z = dt * L, as proposed by Kassam and Trefethen, which avoids
+// the cancellation of the closed forms near z = 0
+struct EtdCoefficients
+{
+    std::vector<double> e, e2, q, f1, f2, f3;
+
+    // rows x cols interior cells of width h, diffusion coefficient d
+    void compute(int rows, int cols, double h, double dt, double d);
+};
+
+// spectral state of the integrator, the coefficients are only recomputed
+// when one of (width, height, dt, du, dv) changes
+struct Etd
+{
+    Etd();
+
+    // width and height of the field with its ghost cells, returns true if
+    // the coefficients had to be computed again
+    bool prepare(int width, int height, double dt, double du, double dv);
+
+    Dct2D dct;
+    EtdCoefficients u, v;
+
+    // spectra of the state, of the reaction terms at the four stages and
+    // of the stage being built, for u and v
+    std::vector<double> state[2], n0[2], na[2], nb[2], nc[2], stage[2];
+
+private:
+    int m_width, m_height;
+    double m_dt, m_du, m_dv;
+};
+
+#endif // ETD_H
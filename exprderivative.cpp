@@ -0,0 +1,282 @@
+#include "exprderivative.h"
+
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+struct ExprDerivative::Node
+{
+    enum Kind {Constant, Variable, Function};
+
+    Kind kind;
+    double value;
+    const double *address;
+    // tinyexpr name of the function or operator ("add", "negate", "sin", ...)
+    string name;
+    Ref a, b;
+};
+
+ExprDerivative::ExprDerivative(const map<const double*, string> &names) :
+    m_names(names)
+{
+
+}
+
+string ExprDerivative::differentiate(const te_expr *expr, const double *var) const
+{
+    Ref n = expr ? convert(expr) : Ref();
+    if(!n)
+        return string();
+
+    Ref d = derive(n, var);
+    return d ? print(d) : string();
+}
+
+ExprDerivative::Ref ExprDerivative::convert(const te_expr *n) const
+{
+    int type = n->type & 0x1F;
+    if(type == TE_CONSTANT)
+        return constant(n->value);
+
+    if(type == TE_VARIABLE)
+    {
+        if(!m_names.count(n->bound))
+            return Ref();
+
+        Node *v = new Node();
+        v->kind = Node::Variable;
+        v->address = n->bound;
+        return Ref(v);
+    }
+
+    // pure functions without arguments are folded by te_compile(), closures
+    // are never created by the solver
+    if(type != TE_FUNCTION1 && type != TE_FUNCTION2)
+        return Ref();
+
+    const char *name = te_function_name(n->function);
+    if(!name)
+        return Ref();
+
+    Ref a = convert((const te_expr*)n->parameters[0]);
+    if(!a)
+        return Ref();
+
+    if(type == TE_FUNCTION1)
+        return string(name) == "negate" ? neg(a) : call(name, a);
+
+    Ref b = convert((const te_expr*)n->parameters[1]);
+    if(!b)
+        return Ref();
+
+    string fname = name;
+    if(fname == "comma")
+        return b;
+
+    return call(fname, a, b);
+}
+
+ExprDerivative::Ref ExprDerivative::derive(const Ref &n, const double *var) const
+{
+    if(n->kind == Node::Constant)
+        return constant(0);
+    if(n->kind == Node::Variable)
+        return constant(n->address == var ? 1 : 0);
+
+    const string &f = n->name;
+    const Ref &a = n->a, &b = n->b;
+
+    Ref da = derive(a, var);
+    if(!da)
+        return Ref();
+
+    // functions of one argument, chain rule on a
+    if(!b)
+    {
+        Ref outer;
+        if(f == "negate")
+            return neg(da);
+        else if(f == "exp")
+            outer = n;
+        else if(f == "ln")
+            outer = div(constant(1), a);
+        else if(f == "log" || f == "log10")
+            // tinyexpr is built without TE_NAT_LOG, log is base 10
+            outer = div(constant(1), mul(a, constant(log(10.0))));
+        else if(f == "sqrt")
+            outer = div(constant(0.5), n);
+        else if(f == "sin")
+            outer = call("cos", a);
+        else if(f == "cos")
+            outer = neg(call("sin", a));
+        else if(f == "tan")
+            outer = div(constant(1), pow(call("cos", a), constant(2)));
+        else if(f == "sinh")
+            outer = call("cosh", a);
+        else if(f == "cosh")
+            outer = call("sinh", a);
+        else if(f == "tanh")
+            outer = sub(constant(1), pow(n, constant(2)));
+        else if(f == "asin")
+            outer = div(constant(1), call("sqrt", sub(constant(1), pow(a, constant(2)))));
+        else if(f == "acos")
+            outer = neg(div(constant(1), call("sqrt", sub(constant(1), pow(a, constant(2))))));
+        else if(f == "atan")
+            outer = div(constant(1), add(constant(1), pow(a, constant(2))));
+        else if(f == "abs")
+            outer = div(a, n);
+        else
+            return Ref();
+
+        return mul(outer, da);
+    }
+
+    Ref db = derive(b, var);
+    if(!db)
+        return Ref();
+
+    if(f == "add")
+        return add(da, db);
+    if(f == "sub")
+        return sub(da, db);
+    if(f == "mul")
+        return add(mul(da, b), mul(a, db));
+    if(f == "divide")
+        return div(sub(mul(da, b), mul(a, db)), pow(b, constant(2)));
+    if(f == "atan2")
+        return div(sub(mul(b, da), mul(a, db)), add(pow(a, constant(2)), pow(b, constant(2))));
+
+    if(f == "pow")
+    {
+        // constant exponents keep the derivative defined for a <= 0
+        if(isConstant(db, 0))
+            return mul(mul(b, pow(a, sub(b, constant(1)))), da);
+
+        return mul(n, add(mul(db, call("ln", a)), div(mul(b, da), a)));
+    }
+
+    return Ref();
+}
+
+string ExprDerivative::print(const Ref &n) const
+{
+    if(n->kind == Node::Constant)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), n->value < 0 ? "(%.17g)" : "%.17g", n->value);
+        return text;
+    }
+
+    if(n->kind == Node::Variable)
+        return m_names.at(n->address);
+
+    // fully parenthesized, tinyexpr does not need to know any precedence
+    static const char *operators[][2] = {
+        {"add", " + "}, {"sub", " - "}, {"mul", " * "}, {"divide", " / "}, {"pow", " ^ "}
+    };
+
+    if(n->name == "negate")
+        return "(-" + print(n->a) + ")";
+
+    for(const auto &op : operators)
+        if(n->name == op[0])
+            return "(" + print(n->a) + op[1] + print(n->b) + ")";
+
+    if(n->b)
+        return n->name + "(" + print(n->a) + ", " + print(n->b) + ")";
+    return n->name + "(" + print(n->a) + ")";
+}
+
+ExprDerivative::Ref ExprDerivative::constant(double value)
+{
+    Node *c = new Node();
+    c->kind = Node::Constant;
+    c->value = value;
+    return Ref(c);
+}
+
+ExprDerivative::Ref ExprDerivative::call(const string &name, const Ref &a, const Ref &b)
+{
+    Node *f = new Node();
+    f->kind = Node::Function;
+    f->name = name;
+    f->a = a;
+    f->b = b;
+    return Ref(f);
+}
+
+ExprDerivative::Ref ExprDerivative::add(const Ref &a, const Ref &b)
+{
+    if(a->kind == Node::Constant && b->kind == Node::Constant)
+        return constant(a->value + b->value);
+    if(isConstant(a, 0))
+        return b;
+    if(isConstant(b, 0))
+        return a;
+    return call("add", a, b);
+}
+
+ExprDerivative::Ref ExprDerivative::sub(const Ref &a, const Ref &b)
+{
+    if(a->kind == Node::Constant && b->kind == Node::Constant)
+        return constant(a->value - b->value);
+    if(isConstant(b, 0))
+        return a;
+    if(isConstant(a, 0))
+        return neg(b);
+    return call("sub", a, b);
+}
+
+ExprDerivative::Ref ExprDerivative::mul(const Ref &a, const Ref &b)
+{
+    if(a->kind == Node::Constant && b->kind == Node::Constant)
+        return constant(a->value * b->value);
+    if(isConstant(a, 0) || isConstant(b, 0))
+        return constant(0);
+    if(isConstant(a, 1))
+        return b;
+    if(isConstant(b, 1))
+        return a;
+    if(isConstant(a, -1))
+        return neg(b);
+    if(isConstant(b, -1))
+        return neg(a);
+    return call("mul", a, b);
+}
+
+ExprDerivative::Ref ExprDerivative::div(const Ref &a, const Ref &b)
+{
+    if(a->kind == Node::Constant && b->kind == Node::Constant)
+        return constant(a->value / b->value);
+    if(isConstant(a, 0))
+        return constant(0);
+    if(isConstant(b, 1))
+        return a;
+    return call("divide", a, b);
+}
+
+ExprDerivative::Ref ExprDerivative::neg(const Ref &a)
+{
+    if(a->kind == Node::Constant)
+        return constant(-a->value);
+    if(a->kind == Node::Function && a->name == "negate")
+        return a->a;
+    return call("negate", a);
+}
+
+ExprDerivative::Ref ExprDerivative::pow(const Ref &a, const Ref &b)
+{
+    if(a->kind == Node::Constant && b->kind == Node::Constant)
+        return constant(std::pow(a->value, b->value));
+    if(isConstant(b, 0))
+        return constant(1);
+    if(isConstant(b, 1))
+        return a;
+    return call("pow", a, b);
+}
+
+bool ExprDerivative::isConstant(const Ref &n, double value)
+{
+    return n->kind == Node::Constant && n->value == value;
+}
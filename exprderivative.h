@@ -0,0 +1,46 @@
+#ifndef EXPRDERIVATIVE_H
+#define EXPRDERIVATIVE_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "tinyexpr.h"
+
+// Symbolic partial derivatives of compiled tinyexpr trees. The result is
+// written back in tinyexpr syntax over the variable names the tree was
+// compiled with, so it goes through te_compile() and ExprProgram like any
+// model expression. Sums with zero, products with zero or one and
+// operations on constants are folded while the derivative is built.
+class ExprDerivative
+{
+public:
+    // names of the variables, by the address they are bound to
+    explicit ExprDerivative(const std::map<const double*, std::string> &names);
+
+    // d expr / d var, empty if the tree uses a function without a
+    // derivative rule (fac, ncr, npr, fmod, floor and ceil are piecewise)
+    std::string differentiate(const te_expr *expr, const double *var) const;
+
+private:
+    struct Node;
+    typedef std::shared_ptr<const Node> Ref;
+
+    Ref convert(const te_expr *n) const;
+    Ref derive(const Ref &n, const double *var) const;
+    std::string print(const Ref &n) const;
+
+    static Ref constant(double value);
+    static Ref call(const std::string &name, const Ref &a, const Ref &b = Ref());
+    static Ref add(const Ref &a, const Ref &b);
+    static Ref sub(const Ref &a, const Ref &b);
+    static Ref mul(const Ref &a, const Ref &b);
+    static Ref div(const Ref &a, const Ref &b);
+    static Ref neg(const Ref &a);
+    static Ref pow(const Ref &a, const Ref &b);
+    static bool isConstant(const Ref &n, double value);
+
+    std::map<const double*, std::string> m_names;
+};
+
+#endif // EXPRDERIVATIVE_H
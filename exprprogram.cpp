@@ -0,0 +1,267 @@
+#include "exprprogram.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+// number of cells processed by every instruction at once
+static const int BLOCK = 256;
+
+typedef double (*Function1)(double);
+typedef double (*Function2)(double, double);
+
+ExprProgram::ExprProgram() :
+    m_depth(0)
+{
+
+}
+
+bool ExprProgram::compile(const te_expr *expr, const double *x, const double *y)
+{
+    return compile(expr, vector<const double*>{x, y});
+}
+
+bool ExprProgram::compile(const te_expr *expr, const vector<const double*> &inputs)
+{
+    clear();
+
+    if(!expr || !lower(expr, inputs, 1))
+    {
+        clear();
+        return false;
+    }
+
+    return true;
+}
+
+void ExprProgram::clear()
+{
+    m_code.clear();
+    m_depth = 0;
+}
+
+bool ExprProgram::isEmpty() const
+{
+    return m_code.empty();
+}
+
+void ExprProgram::rebind(const map<const double*, const double*> &addresses)
+{
+    for(Instruction &ins : m_code)
+    {
+        if(ins.op != Variable)
+            continue;
+
+        auto address = addresses.find(ins.address);
+        if(address != addresses.end())
+            ins.address = address->second;
+    }
+}
+
+bool ExprProgram::lower(const te_expr *n, const vector<const double*> &inputs, int depth)
+{
+    m_depth = max(m_depth, depth);
+
+    int type = n->type & 0x1F;
+    if(type == TE_CONSTANT)
+    {
+        push(Constant);
+        m_code.back().value = n->value;
+        return true;
+    }
+
+    if(type == TE_VARIABLE)
+    {
+        auto input = find(inputs.begin(), inputs.end(), n->bound);
+        if(input != inputs.end())
+        {
+            push(Load);
+            m_code.back().input = input - inputs.begin();
+        }
+        else
+        {
+            push(Variable);
+            m_code.back().address = n->bound;
+        }
+        return true;
+    }
+
+    // closures and functions of more than two arguments are never created
+    // by the solver
+    if(type != TE_FUNCTION1 && type != TE_FUNCTION2)
+        return false;
+
+    const te_expr *a = (const te_expr*)n->parameters[0];
+    const char *name = te_function_name(n->function);
+    string fname = name ? name : "";
+
+    if(type == TE_FUNCTION1)
+    {
+        if(!lower(a, inputs, depth))
+            return false;
+
+        if(fname == "negate")
+            push(Neg);
+        else
+        {
+            push(Call1);
+            m_code.back().function = n->function;
+        }
+        return true;
+    }
+
+    const te_expr *b = (const te_expr*)n->parameters[1];
+
+    // small integer powers, as in y^2, become repeated products
+    if(fname == "pow" && (b->type & 0x1F) == TE_CONSTANT &&
+       b->value >= 2 && b->value <= 4 && b->value == floor(b->value))
+    {
+        if(!lower(a, inputs, depth))
+            return false;
+
+        push(PowInt);
+        m_code.back().exponent = (int)b->value;
+        return true;
+    }
+
+    if(fname == "comma")
+        return lower(b, inputs, depth);
+
+    if(!lower(a, inputs, depth) || !lower(b, inputs, depth + 1))
+        return false;
+
+    if(fname == "add")
+        push(Add);
+    else if(fname == "sub")
+        push(Sub);
+    else if(fname == "mul")
+        push(Mul);
+    else if(fname == "divide")
+        push(Div);
+    else if(fname == "fmod")
+        push(Mod);
+    else if(fname == "pow")
+        push(Pow);
+    else
+    {
+        push(Call2);
+        m_code.back().function = n->function;
+    }
+
+    return true;
+}
+
+void ExprProgram::push(Opcode op)
+{
+    Instruction ins = {op, 0.0, nullptr, nullptr, 0, 0};
+    m_code.push_back(ins);
+}
+
+template<class T>
+void ExprProgram::eval(const T *x, const T *y, T *out, int n, std::vector<T> &stack) const
+{
+    const T *inputs[] = {x, y};
+    eval(inputs, out, n, stack);
+}
+
+template<class T>
+void ExprProgram::eval(const T *const *inputs, T *out, int n, std::vector<T> &stack) const
+{
+    // two spare slots below the bottom keep the operand pointers in range
+    stack.resize((m_depth + 2) * BLOCK);
+    T *bottom = stack.data() + 2 * BLOCK;
+
+    for(int begin = 0; begin < n; begin += BLOCK)
+    {
+        const int len = min(BLOCK, n - begin);
+
+        // sp points past the top of the stack, every slot holds BLOCK values
+        T *sp = bottom;
+
+        for(const Instruction &ins : m_code)
+        {
+            T *a = sp - 2 * BLOCK;
+            T *b = sp - BLOCK;
+
+            switch(ins.op)
+            {
+            case Constant:
+                fill(sp, sp + len, (T)ins.value);
+                sp += BLOCK;
+                break;
+            case Variable:
+                fill(sp, sp + len, (T)*ins.address);
+                sp += BLOCK;
+                break;
+            case Load:
+                memcpy(sp, inputs[ins.input] + begin, len * sizeof(T));
+                sp += BLOCK;
+                break;
+            case Add:
+                for(int k = 0; k < len; k++)
+                    a[k] = a[k] + b[k];
+                sp -= BLOCK;
+                break;
+            case Sub:
+                for(int k = 0; k < len; k++)
+                    a[k] = a[k] - b[k];
+                sp -= BLOCK;
+                break;
+            case Mul:
+                for(int k = 0; k < len; k++)
+                    a[k] = a[k] * b[k];
+                sp -= BLOCK;
+                break;
+            case Div:
+                for(int k = 0; k < len; k++)
+                    a[k] = a[k] / b[k];
+                sp -= BLOCK;
+                break;
+            case Mod:
+                for(int k = 0; k < len; k++)
+                    a[k] = fmod(a[k], b[k]);
+                sp -= BLOCK;
+                break;
+            case Pow:
+                for(int k = 0; k < len; k++)
+                    a[k] = pow(a[k], b[k]);
+                sp -= BLOCK;
+                break;
+            case Call2:
+                for(int k = 0; k < len; k++)
+                    a[k] = ((Function2)ins.function)(a[k], b[k]);
+                sp -= BLOCK;
+                break;
+            case Neg:
+                for(int k = 0; k < len; k++)
+                    b[k] = -b[k];
+                break;
+            case PowInt:
+                if(ins.exponent == 2)
+                    for(int k = 0; k < len; k++)
+                        b[k] = b[k] * b[k];
+                else if(ins.exponent == 3)
+                    for(int k = 0; k < len; k++)
+                        b[k] = b[k] * b[k] * b[k];
+                else
+                    for(int k = 0; k < len; k++)
+                        b[k] = (b[k] * b[k]) * (b[k] * b[k]);
+                break;
+            case Call1:
+                for(int k = 0; k < len; k++)
+                    b[k] = ((Function1)ins.function)(b[k]);
+                break;
+            }
+        }
+
+        memcpy(out + begin, bottom, len * sizeof(T));
+    }
+}
+
+template void ExprProgram::eval<double>(const double*, const double*, double*, int, std::vector<double>&) const;
+template void ExprProgram::eval<float>(const float*, const float*, float*, int, std::vector<float>&) const;
+template void ExprProgram::eval<double>(const double *const*, double*, int, std::vector<double>&) const;
+template void ExprProgram::eval<float>(const float *const*, float*, int, std::vector<float>&) const;
@@ -0,0 +1,64 @@
+#ifndef EXPRPROGRAM_H
+#define EXPRPROGRAM_H
+
+#include <map>
+#include <vector>
+
+#include "tinyexpr.h"
+
+// A compiled tinyexpr tree lowered to a flat list of stack instructions.
+// eval() runs every instruction over a whole block of (x, y) values, so the
+// tree is walked once per block instead of once per cell and every opcode
+// becomes a simple loop the compiler can vectorize. Models with more than
+// two species bind one input per species instead of x and y.
+class ExprProgram
+{
+public:
+    ExprProgram();
+
+    // x and y are the addresses the expression variables were bound to.
+    // Returns false if the tree contains nodes that can not be lowered
+    bool compile(const te_expr *expr, const double *x, const double *y);
+    // input k of eval() is the variable bound to inputs[k]
+    bool compile(const te_expr *expr, const std::vector<const double*> &inputs);
+    void clear();
+    bool isEmpty() const;
+    // the variables bound to a key of addresses read its value instead,
+    // so that a copy of the program runs on other parameters
+    void rebind(const std::map<const double*, const double*> &addresses);
+
+    // out[k] = f(x[k], y[k]) for k in [0, n), stack is caller owned scratch
+    // memory so that one program can be shared between threads. Defined
+    // for float and double
+    template<class T>
+    void eval(const T *x, const T *y, T *out, int n, std::vector<T> &stack) const;
+    // out[k] = f(inputs[0][k], inputs[1][k], ...)
+    template<class T>
+    void eval(const T *const *inputs, T *out, int n, std::vector<T> &stack) const;
+
+private:
+    enum Opcode
+    {
+        Constant, Variable, Load,
+        Add, Sub, Mul, Div, Neg, Mod, Pow, PowInt,
+        Call1, Call2
+    };
+
+    struct Instruction
+    {
+        Opcode op;
+        double value;
+        const double *address;
+        const void *function;
+        int exponent;
+        int input;
+    };
+
+    bool lower(const te_expr *n, const std::vector<const double*> &inputs, int depth);
+    void push(Opcode op);
+
+    std::vector<Instruction> m_code;
+    int m_depth;
+};
+
+#endif // EXPRPROGRAM_H
@@ -0,0 +1,273 @@
+#include "fft.h"
+
+#include <cmath>
+#include <mutex>
+
+using namespace std;
+
+static const double PI = 3.14159265358979323846;
+
+// std::complex multiplication checks for infinities and NaNs in a library
+// call, which dominates the transforms
+static inline Complex mul(const Complex &a, const Complex &b)
+{
+    return Complex(a.real() * b.real() - a.imag() * b.imag(),
+                   a.real() * b.imag() + a.imag() * b.real());
+}
+
+Fft::Fft() : m_n(0), m_m(0)
+{
+}
+
+void Fft::setSize(int n)
+{
+    m_n = n;
+    m_m = 1;
+    while(m_m < n)
+        m_m *= 2;
+
+    // Bluestein needs a linear convolution of length 2n - 1
+    bool bluestein = m_m != n;
+    if(bluestein)
+        while(m_m < 2 * n - 1)
+            m_m *= 2;
+
+    m_twiddles.resize(m_m / 2);
+    for(int k = 0; k < m_m / 2; k++)
+        m_twiddles[k] = polar(1.0, -2 * PI * k / m_m);
+
+    int bits = 0;
+    while((1 << bits) < m_m)
+        bits++;
+    m_reverse.resize(m_m);
+    for(int k = 0; k < m_m; k++)
+    {
+        int r = 0;
+        for(int b = 0; b < bits; b++)
+            if(k & (1 << b))
+                r |= 1 << (bits - 1 - b);
+        m_reverse[k] = r;
+    }
+
+    m_chirp.clear();
+    m_kernel.clear();
+    if(!bluestein)
+        return;
+
+    // chirp[k] = exp(-i pi k^2 / n), k^2 is reduced modulo 2n to keep the
+    // argument small
+    m_chirp.resize(n);
+    for(int k = 0; k < n; k++)
+        m_chirp[k] = polar(1.0, -PI * (double)((long long)k * k % (2LL * n)) / n);
+
+    m_kernel.assign(m_m, Complex(0, 0));
+    m_kernel[0] = conj(m_chirp[0]);
+    for(int k = 1; k < n; k++)
+        m_kernel[k] = m_kernel[m_m - k] = conj(m_chirp[k]);
+    radix2(m_kernel.data());
+}
+
+int Fft::size() const
+{
+    return m_n;
+}
+
+void Fft::radix2(Complex *x) const
+{
+    for(int k = 0; k < m_m; k++)
+        if(k < m_reverse[k])
+            swap(x[k], x[m_reverse[k]]);
+
+    for(int len = 2; len <= m_m; len *= 2)
+    {
+        int half = len / 2, step = m_m / len;
+        for(int i = 0; i < m_m; i += len)
+        {
+            for(int k = 0; k < half; k++)
+            {
+                Complex t = mul(m_twiddles[k * step], x[i + k + half]);
+                x[i + k + half] = x[i + k] - t;
+                x[i + k] += t;
+            }
+        }
+    }
+}
+
+void Fft::transform(Complex *x, vector<Complex> &scratch) const
+{
+    if(m_chirp.empty())
+    {
+        radix2(x);
+        return;
+    }
+
+    // X[k] = chirp[k] * sum (x[n] chirp[n]) conj(chirp[k - n]), the sum is
+    // a circular convolution of length m_m done with two transforms. The
+    // inverse transform is the forward one of the conjugate
+    scratch.resize(m_m);
+    for(int k = 0; k < m_n; k++)
+        scratch[k] = mul(x[k], m_chirp[k]);
+    for(int k = m_n; k < m_m; k++)
+        scratch[k] = Complex(0, 0);
+
+    radix2(scratch.data());
+    for(int k = 0; k < m_m; k++)
+        scratch[k] = conj(mul(scratch[k], m_kernel[k]));
+    radix2(scratch.data());
+
+    for(int k = 0; k < m_n; k++)
+        x[k] = mul(conj(scratch[k]), m_chirp[k]) / (double)m_m;
+}
+
+#ifdef HAVE_FFTW
+
+// the FFTW planner is not thread safe, and solvers of an ensemble plan
+// their transforms concurrently
+static mutex s_planner;
+
+Dct::Dct() : m_n(0), m_forward(nullptr), m_inverse(nullptr)
+{
+}
+
+Dct::~Dct()
+{
+    setSize(0);
+}
+
+void Dct::setSize(int n)
+{
+    lock_guard<mutex> lock(s_planner);
+    if(m_forward)
+    {
+        fftw_destroy_plan(m_forward);
+        fftw_destroy_plan(m_inverse);
+        m_forward = m_inverse = nullptr;
+    }
+
+    m_n = n;
+    if(n == 0)
+        return;
+
+    // plans are executed on other arrays, possibly from several threads
+    vector<double> in(n), out(n);
+    unsigned flags = FFTW_ESTIMATE | FFTW_UNALIGNED;
+    m_forward = fftw_plan_r2r_1d(n, in.data(), out.data(), FFTW_REDFT10, flags);
+    m_inverse = fftw_plan_r2r_1d(n, in.data(), out.data(), FFTW_REDFT01, flags);
+}
+
+void Dct::forward(const double *x0, const double *x1, double *y0, double *y1, FftScratch &) const
+{
+    fftw_execute_r2r(m_forward, const_cast<double*>(x0), y0);
+    if(x1)
+        fftw_execute_r2r(m_forward, const_cast<double*>(x1), y1);
+}
+
+void Dct::inverse(const double *y0, const double *y1, double *x0, double *x1, FftScratch &) const
+{
+    fftw_execute_r2r(m_inverse, const_cast<double*>(y0), x0);
+    if(y1)
+        fftw_execute_r2r(m_inverse, const_cast<double*>(y1), x1);
+
+    for(int k = 0; k < m_n; k++)
+    {
+        x0[k] /= 2 * m_n;
+        if(y1)
+            x1[k] /= 2 * m_n;
+    }
+}
+
+#else
+
+Dct::Dct() : m_n(0)
+{
+}
+
+Dct::~Dct()
+{
+}
+
+void Dct::setSize(int n)
+{
+    m_n = n;
+    m_fft.setSize(n);
+
+    m_shift.resize(n);
+    for(int k = 0; k < n; k++)
+        m_shift[k] = polar(1.0, -PI * k / (2.0 * n));
+}
+
+void Dct::forward(const double *x0, const double *x1, double *y0, double *y1, FftScratch &scratch) const
+{
+    // v holds the even samples in order followed by the odd ones reversed,
+    // then y[k] = 2 Re(exp(-i pi k / 2N) V[k]). With z = v0 + i v1, the
+    // transforms of the real sequences are V0[k] = (Z[k] + conj(Z[N-k])) / 2
+    // and V1[k] = (Z[k] - conj(Z[N-k])) / 2i
+    scratch.data.resize(m_n);
+    Complex *z = scratch.data.data();
+
+    for(int k = 0; 2 * k < m_n; k++)
+        z[k] = Complex(x0[2 * k], x1 ? x1[2 * k] : 0);
+    for(int k = 0; 2 * k + 1 < m_n; k++)
+        z[m_n - 1 - k] = Complex(x0[2 * k + 1], x1 ? x1[2 * k + 1] : 0);
+
+    m_fft.transform(z, scratch.fft);
+
+    // both outputs of a pair (k, N - k) are written after reading both
+    // inputs, so the loop runs over the first half
+    for(int k = 0; 2 * k <= m_n; k++)
+    {
+        int l = k == 0 ? 0 : m_n - k;
+        Complex a = z[k], b = z[l];
+        Complex v0k = (a + conj(b)) * 0.5, v1k = (a - conj(b)) * Complex(0, -0.5);
+        Complex v0l = (b + conj(a)) * 0.5, v1l = (b - conj(a)) * Complex(0, -0.5);
+
+        y0[k] = 2 * mul(m_shift[k], v0k).real();
+        y0[l] = 2 * mul(m_shift[l], v0l).real();
+        if(x1)
+        {
+            y1[k] = 2 * mul(m_shift[k], v1k).real();
+            y1[l] = 2 * mul(m_shift[l], v1l).real();
+        }
+    }
+}
+
+void Dct::inverse(const double *y0, const double *y1, double *x0, double *x1, FftScratch &scratch) const
+{
+    // V[k] = conj(shift[k]) (y[k] - i y[N - k]) / 2 with y[N] = 0, then v is
+    // the inverse FFT of V, computed as the conjugate of a forward one. The
+    // spectra of real sequences are hermitian, so V0 + i V1 transforms to
+    // v0 + i v1
+    scratch.data.resize(m_n);
+    Complex *z = scratch.data.data();
+
+    for(int k = 0; k < m_n; k++)
+    {
+        Complex s = conj(m_shift[k]) * 0.5;
+        Complex v0 = mul(s, Complex(y0[k], k == 0 ? 0 : -y0[m_n - k]));
+        Complex v1 = y1 ? mul(s, Complex(y1[k], k == 0 ? 0 : -y1[m_n - k])) : Complex(0, 0);
+        z[k] = conj(v0 + Complex(-v1.imag(), v1.real()));
+    }
+
+    m_fft.transform(z, scratch.fft);
+
+    // conj(z) / N is v0 + i v1
+    for(int k = 0; 2 * k < m_n; k++)
+    {
+        x0[2 * k] = z[k].real() / m_n;
+        if(x1)
+            x1[2 * k] = -z[k].imag() / m_n;
+    }
+    for(int k = 0; 2 * k + 1 < m_n; k++)
+    {
+        x0[2 * k + 1] = z[m_n - 1 - k].real() / m_n;
+        if(x1)
+            x1[2 * k + 1] = -z[m_n - 1 - k].imag() / m_n;
+    }
+}
+
+#endif
+
+int Dct::size() const
+{
+    return m_n;
+}
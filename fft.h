@@ -0,0 +1,77 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <vector>
+
+#ifdef HAVE_FFTW
+#include <fftw3.h>
+#endif
+
+typedef std::complex<double> Complex;
+
+// per-thread work buffers of the transforms
+struct FftScratch
+{
+    std::vector<Complex> data, fft;
+};
+
+// Complex forward FFT of any length: iterative radix-2 for powers of two,
+// Bluestein's chirp-z algorithm on top of it for the other lengths
+class Fft
+{
+public:
+    Fft();
+
+    void setSize(int n);
+    int size() const;
+
+    // in place, X[k] = sum x[n] exp(-2 pi i k n / N). scratch is resized
+    // as needed, so concurrent calls only need their own
+    void transform(Complex *x, std::vector<Complex> &scratch) const;
+
+private:
+    void radix2(Complex *x) const;
+
+    int m_n;
+    // length of the radix-2 transform, m_n or the Bluestein padding
+    int m_m;
+    std::vector<Complex> m_twiddles;
+    std::vector<int> m_reverse;
+    // Bluestein chirp and transformed convolution kernel
+    std::vector<Complex> m_chirp, m_kernel;
+};
+
+// Cosine transform of the zero flux boundary conditions of the solver.
+// forward() computes y[k] = 2 sum x[n] cos(pi k (2n + 1) / 2N) (FFTW's
+// REDFT10) and inverse() undoes it. The bundled version maps the transform
+// to a complex FFT of the same length with Makhoul's reordering, and
+// packs the two real sequences in the real and imaginary parts of one
+// complex transform. x1 and y1 can be null to transform one sequence
+class Dct
+{
+public:
+    Dct();
+    ~Dct();
+
+    void setSize(int n);
+    int size() const;
+
+    void forward(const double *x0, const double *x1, double *y0, double *y1, FftScratch &scratch) const;
+    void inverse(const double *y0, const double *y1, double *x0, double *x1, FftScratch &scratch) const;
+
+private:
+    Dct(const Dct &);
+    Dct &operator=(const Dct &);
+
+    int m_n;
+#ifdef HAVE_FFTW
+    fftw_plan m_forward, m_inverse;
+#else
+    Fft m_fft;
+    // exp(-i pi k / 2N)
+    std::vector<Complex> m_shift;
+#endif
+};
+
+#endif // FFT_H
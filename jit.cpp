@@ -0,0 +1,460 @@
+#include "jit.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JIT_SUPPORTED
+#include <dlfcn.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define JIT_CPUID
+#include <cpuid.h>
+#endif
+
+using namespace std;
+
+// no contraction into fused multiply-add, so the kernel rounds like the
+// interpreted path
+static const char *COMPILE_FLAGS = "-O3 -march=native -ffp-contract=off -fPIC -shared";
+
+static unsigned long long fnv1a(const string &text)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for(unsigned char c : text)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static string compiler()
+{
+    const char *cc = getenv("CC");
+    return cc && *cc ? cc : "cc";
+}
+
+// processor -march=native builds for, part of the cache key so that a
+// cache shared between machines never hands out an object that uses
+// instructions this one lacks
+static string cpuSignature()
+{
+    ostringstream out;
+    out << hex;
+#if defined(JIT_CPUID)
+    // vendor, family and model, and the feature bits of leaves 1, 7 and
+    // 0x80000001. The APIC id in ebx of leaf 1 differs between cores
+    unsigned int top, a, b, c, d;
+    __cpuid(0, top, b, c, d);
+    out << b << ' ' << d << ' ' << c;
+    __cpuid(1, a, b, c, d);
+    out << ' ' << a << ' ' << c << ' ' << d;
+    if(top >= 7)
+    {
+        __cpuid_count(7, 0, a, b, c, d);
+        out << ' ' << b << ' ' << c << ' ' << d;
+    }
+    if(__get_cpuid(0x80000001, &a, &b, &c, &d))
+        out << ' ' << c << ' ' << d;
+#elif defined(JIT_SUPPORTED)
+    struct utsname name;
+    if(uname(&name) == 0)
+        out << name.machine << ' ' << name.release;
+#endif
+    return out.str();
+}
+
+#ifdef JIT_SUPPORTED
+// Kernels run inside the process, so they are only built and loaded in a
+// directory of the user that nobody else can write to, and dir is
+// created that way when it is missing
+static bool isPrivateDir(const string &dir)
+{
+    mkdir(dir.c_str(), 0700);
+
+    struct stat st;
+    return stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() &&
+           !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+// regular file of the user that nobody else can write to
+static bool isPrivateFile(const string &path)
+{
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == getuid() &&
+           !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+// builds of this process, to name their temporary files apart
+static atomic<unsigned> s_builds(0);
+#endif
+
+JitKernel::JitKernel() :
+    step(nullptr), react(nullptr), m_handle(nullptr), m_x(nullptr), m_y(nullptr)
+{
+
+}
+
+JitKernel::~JitKernel()
+{
+    unload();
+}
+
+bool JitKernel::build(const te_expr *fu, const te_expr *fv,
+                      const std::vector<const double*> &params, const double *x, const double *y,
+                      const std::vector<const double*> &fields, bool singlePrecision)
+{
+    unload();
+
+    m_params = params;
+    m_fields = fields;
+    m_x = x;
+    m_y = y;
+
+    string fuCode, fvCode;
+    if(!fu || !fv || !translate(fu, fuCode) || !translate(fv, fvCode))
+    {
+        m_error = "expressions can not be translated to C";
+        return false;
+    }
+
+#ifdef JIT_SUPPORTED
+    string code = source(fuCode, fvCode, singlePrecision);
+    string cc = compiler();
+
+    static const string cpu = cpuSignature();
+
+    char name[32];
+    snprintf(name, sizeof(name), "rd_%016llx", fnv1a(cc + COMPILE_FLAGS + cpu + code));
+
+    string dir = cacheDir();
+    if(m_cacheDir.empty())
+        mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0700);
+    if(dir.empty() || !isPrivateDir(dir))
+    {
+        m_error = "kernel cache " + dir + " is not a private directory of the user";
+        return false;
+    }
+    string base = dir + "/" + name;
+
+    // reuse a kernel built by an earlier run
+    if(isPrivateFile(base + ".so") && load(base + ".so"))
+        return true;
+
+    // the source, log and object are written under names of their own and
+    // renamed into place, so that concurrent builds of the same kernel do
+    // not write to the same files and no run loads a half written object
+    string tmp = base + "." + to_string(getpid()) + "." + to_string(s_builds++);
+    ofstream file((tmp + ".c").c_str());
+    file << code;
+    file.close();
+    if(!file)
+    {
+        remove((tmp + ".c").c_str());
+        m_error = "can not write " + tmp + ".c";
+        return false;
+    }
+
+    string command = cc + " " + COMPILE_FLAGS + " -o '" + tmp + ".so' '" + tmp + ".c' -lm > '" + tmp + ".log' 2>&1";
+    bool built = system(command.c_str()) == 0;
+    rename((tmp + ".c").c_str(), (base + ".c").c_str());
+    rename((tmp + ".log").c_str(), (base + ".log").c_str());
+    if(!built || rename((tmp + ".so").c_str(), (base + ".so").c_str()) != 0)
+    {
+        remove((tmp + ".so").c_str());
+        m_error = "compilation failed, see " + base + ".log";
+        return false;
+    }
+
+    return load(base + ".so");
+#else
+    m_error = "native kernels are not supported on this platform";
+    return false;
+#endif
+}
+
+bool JitKernel::share(const JitKernel &other)
+{
+    unload();
+
+    if(!other.isLoaded())
+    {
+        m_error = other.m_error;
+        return false;
+    }
+
+    // the loader counts the references to the object
+    return load(other.m_path);
+}
+
+void JitKernel::unload()
+{
+#ifdef JIT_SUPPORTED
+    if(m_handle)
+        dlclose(m_handle);
+#endif
+    m_handle = nullptr;
+    step = nullptr;
+    react = nullptr;
+}
+
+bool JitKernel::isLoaded() const
+{
+    return step != nullptr;
+}
+
+void JitKernel::setCacheDir(const string &dir)
+{
+    m_cacheDir = dir;
+}
+
+string JitKernel::cacheDir() const
+{
+    if(!m_cacheDir.empty())
+        return m_cacheDir;
+
+    // per user, other users could plant kernels in a shared directory
+    string cache;
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if(xdg && *xdg == '/')
+        cache = xdg;
+    else if(home && *home == '/')
+        cache = string(home) + "/.cache";
+#ifdef JIT_SUPPORTED
+    else if(const struct passwd *user = getpwuid(getuid()))
+        cache = string(user->pw_dir) + "/.cache";
+#endif
+    return cache.empty() ? cache : cache + "/rd-kernels";
+}
+
+string JitKernel::errorString() const
+{
+    return m_error;
+}
+
+bool JitKernel::load(const string &path)
+{
+#ifdef JIT_SUPPORTED
+    m_handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!m_handle)
+    {
+        m_error = dlerror();
+        return false;
+    }
+
+    m_path = path;
+    step = (StepFunction)dlsym(m_handle, "rd_step");
+    react = (ReactFunction)dlsym(m_handle, "rd_react");
+    if(!step || !react)
+    {
+        m_error = "kernel entry points not found in " + path;
+        unload();
+        return false;
+    }
+
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+bool JitKernel::translate(const te_expr *n, string &code) const
+{
+    int type = n->type & 0x1F;
+
+    if(type == TE_CONSTANT)
+    {
+        if(std::isnan(n->value))
+            code += "((real)NAN)";
+        else if(std::isinf(n->value))
+            code += n->value > 0 ? "((real)INFINITY)" : "(-(real)INFINITY)";
+        else
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "((real)%.17g)", n->value);
+            code += buf;
+        }
+        return true;
+    }
+
+    if(type == TE_VARIABLE)
+    {
+        if(n->bound == m_x)
+            code += "x";
+        else if(n->bound == m_y)
+            code += "y";
+        else
+        {
+            // cell c of the array of a parameter field
+            for(size_t k = 0; k < m_fields.size(); k++)
+            {
+                if(m_fields[k] == n->bound)
+                {
+                    code += "q[" + to_string(k) + "][c]";
+                    return true;
+                }
+            }
+            for(size_t k = 0; k < m_params.size(); k++)
+            {
+                if(m_params[k] == n->bound)
+                {
+                    code += "((real)p[" + to_string(k) + "])";
+                    return true;
+                }
+            }
+            return false;
+        }
+        return true;
+    }
+
+    if(type != TE_FUNCTION1 && type != TE_FUNCTION2)
+        return false;
+
+    const char *name = te_function_name(n->function);
+    if(!name)
+        return false;
+
+    string fname = name;
+    const te_expr *a = (const te_expr*)n->parameters[0];
+    string lhs, rhs;
+
+    if(!translate(a, lhs))
+        return false;
+
+    if(type == TE_FUNCTION1)
+    {
+        // tinyexpr names that differ from the C library ones
+        static const char *names[][2] = {
+            {"negate", "-"}, {"abs", "fabs"}, {"ln", "log"}, {"log", "log10"},
+            {"acos", "acos"}, {"asin", "asin"}, {"atan", "atan"}, {"ceil", "ceil"},
+            {"cos", "cos"}, {"cosh", "cosh"}, {"exp", "exp"}, {"floor", "floor"},
+            {"log10", "log10"}, {"sin", "sin"}, {"sinh", "sinh"}, {"sqrt", "sqrt"},
+            {"tan", "tan"}, {"tanh", "tanh"}
+        };
+
+        for(const auto &entry : names)
+        {
+            if(fname == entry[0])
+            {
+                code += string("(") + entry[1] + "(" + lhs + "))";
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const te_expr *b = (const te_expr*)n->parameters[1];
+
+    // same lowering of small integer powers as ExprProgram
+    if(fname == "pow" && (b->type & 0x1F) == TE_CONSTANT &&
+       b->value >= 2 && b->value <= 4 && b->value == floor(b->value))
+    {
+        int exponent = (int)b->value;
+        if(exponent == 2)
+            code += "(" + lhs + "*" + lhs + ")";
+        else if(exponent == 3)
+            code += "(" + lhs + "*" + lhs + "*" + lhs + ")";
+        else
+            code += "((" + lhs + "*" + lhs + ")*(" + lhs + "*" + lhs + "))";
+        return true;
+    }
+
+    if(!translate(b, rhs))
+        return false;
+
+    if(fname == "add")
+        code += "(" + lhs + " + " + rhs + ")";
+    else if(fname == "sub")
+        code += "(" + lhs + " - " + rhs + ")";
+    else if(fname == "mul")
+        code += "(" + lhs + " * " + rhs + ")";
+    else if(fname == "divide")
+        code += "(" + lhs + " / " + rhs + ")";
+    else if(fname == "comma")
+        code += rhs;
+    else if(fname == "fmod" || fname == "pow" || fname == "atan2")
+        code += "(" + fname + "(" + lhs + ", " + rhs + "))";
+    else
+        return false;
+
+    return true;
+}
+
+string JitKernel::source(const string &fu, const string &fv, bool singlePrecision) const
+{
+    // tgmath picks the float versions of the math functions in single
+    // precision
+    ostringstream out;
+    out << "#include <tgmath.h>\n"
+           "\n"
+           "typedef " << (singlePrecision ? "float" : "double") << " real;\n"
+           "\n"
+           "static inline real fu(real x, real y, const double *p, const real *const *q, long c)\n"
+           "{\n"
+           "    (void)x; (void)y; (void)p; (void)q; (void)c;\n"
+           "    return " << fu << ";\n"
+           "}\n"
+           "\n"
+           "static inline real fv(real x, real y, const double *p, const real *const *q, long c)\n"
+           "{\n"
+           "    (void)x; (void)y; (void)p; (void)q; (void)c;\n"
+           "    return " << fv << ";\n"
+           "}\n"
+           "\n"
+           "void rd_step(const void *u0, const void *v0, void *u, void *v,\n"
+           "             int begin, int end, int n, int stride,\n"
+           "             double cu, double cv, double dt, const double *p, const void *const *q)\n"
+           "{\n"
+           "    const real ru = cu, rv = cv, rdt = dt;\n"
+           "    const real *const *qr = (const real *const *)q;\n"
+           "\n"
+           "    for(int i = begin; i < end; i++)\n"
+           "    {\n"
+           "        const real *uu = (const real*)u0 + (long)(i - 1) * stride, *um = uu + stride, *ud = um + stride;\n"
+           "        const real *vu = (const real*)v0 + (long)(i - 1) * stride, *vm = vu + stride, *vd = vm + stride;\n"
+           "        real *uo = (real*)u + (long)i * stride, *vo = (real*)v + (long)i * stride;\n"
+           "\n"
+           "        for(int j = 1; j < n - 1; j++)\n"
+           "        {\n"
+           "            real x = um[j], y = vm[j];\n"
+           "            real lu = uu[j] + ud[j] + um[j-1] + um[j+1] + uu[j-1] + ud[j+1] + uu[j+1] + ud[j-1] - 8 * um[j];\n"
+           "            real lv = vu[j] + vd[j] + vm[j-1] + vm[j+1] + vu[j-1] + vd[j+1] + vu[j+1] + vd[j-1] - 8 * vm[j];\n"
+           "            long c = (long)i * stride + j;\n"
+           "            uo[j] = um[j] + rdt * (ru * lu + fu(x, y, p, qr, c));\n"
+           "            vo[j] = vm[j] + rdt * (rv * lv + fv(x, y, p, qr, c));\n"
+           "        }\n"
+           "    }\n"
+           "}\n"
+           "\n"
+           "void rd_react(const void *u0, const void *v0, void *ru, void *rv,\n"
+           "              int begin, int end, int n, int stride, const double *p, const void *const *q)\n"
+           "{\n"
+           "    const real *const *qr = (const real *const *)q;\n"
+           "\n"
+           "    for(int i = begin; i < end; i++)\n"
+           "    {\n"
+           "        const real *um = (const real*)u0 + (long)i * stride, *vm = (const real*)v0 + (long)i * stride;\n"
+           "        real *uo = (real*)ru + (long)i * stride, *vo = (real*)rv + (long)i * stride;\n"
+           "\n"
+           "        for(int j = 1; j < n - 1; j++)\n"
+           "        {\n"
+           "            long c = (long)i * stride + j;\n"
+           "            uo[j] = fu(um[j], vm[j], p, qr, c);\n"
+           "            vo[j] = fv(um[j], vm[j], p, qr, c);\n"
+           "        }\n"
+           "    }\n"
+           "}\n";
+    return out.str();
+}
@@ -0,0 +1,72 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <string>
+#include <vector>
+
+#include "tinyexpr.h"
+
+// Reaction terms translated to C and fused with the diffusion update. The
+// source is built by the system C compiler into a shared object that is
+// cached on disk, keyed by a hash of the generated code, the compiler and
+// the processor, and loaded with dlopen. Parameters are passed at every call, so changing their values
+// does not require a new build. Parameters bound to fields are read from
+// arrays laid out like u0, one per field.
+class JitKernel
+{
+public:
+    // updates rows [begin, end) of u, v from u0, v0, p holds the parameters
+    // and q the parameter fields. The fields are float or double arrays, as
+    // requested to build()
+    typedef void (*StepFunction)(const void *u0, const void *v0, void *u, void *v,
+                                 int begin, int end, int n, int stride,
+                                 double cu, double cv, double dt, const double *p,
+                                 const void *const *q);
+
+    // writes the reaction terms of rows [begin, end) to ru, rv
+    typedef void (*ReactFunction)(const void *u0, const void *v0, void *ru, void *rv,
+                                  int begin, int end, int n, int stride, const double *p,
+                                  const void *const *q);
+
+    JitKernel();
+    ~JitKernel();
+
+    // params are the addresses bound to the model parameters, x and y the
+    // ones bound to the field values and fields the ones of the parameters
+    // read from q[k] instead of p. Returns false if the expressions can not
+    // be translated, no compiler is available or the build fails
+    bool build(const te_expr *fu, const te_expr *fv,
+               const std::vector<const double*> &params, const double *x, const double *y,
+               const std::vector<const double*> &fields, bool singlePrecision = false);
+    // loads the kernel other has loaded instead of building it, for
+    // solvers of the same expressions with other parameter values
+    bool share(const JitKernel &other);
+    void unload();
+    bool isLoaded() const;
+
+    // directory of the cached kernels, $XDG_CACHE_HOME/rd-kernels or
+    // ~/.cache/rd-kernels by default. Nothing is built or loaded unless
+    // it belongs to the user and only the user can write to it
+    void setCacheDir(const std::string &dir);
+    std::string cacheDir() const;
+    std::string errorString() const;
+
+    StepFunction step;
+    ReactFunction react;
+
+private:
+    bool translate(const te_expr *n, std::string &code) const;
+    std::string source(const std::string &fu, const std::string &fv, bool singlePrecision) const;
+    bool load(const std::string &path);
+
+    std::string m_cacheDir;
+    std::string m_error;
+    void *m_handle;
+    std::string m_path;
+
+    // used while translating
+    std::vector<const double*> m_params, m_fields;
+    const double *m_x, *m_y;
+};
+
+#endif // JIT_H
@@ -0,0 +1,302 @@
+#include "kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+
+// the vector helpers are inlined into the flattened entry points below,
+// so vectors never cross a call boundary
+#pragma GCC diagnostic ignored "-Wpsabi"
+// fused multiply-add would round differently from the scalar reference
+#pragma GCC optimize("fp-contract=off")
+#define KERNEL_TARGET(isa) __attribute__((target(isa), flatten))
+#define HELPER_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+template<class T>
+static inline T laplace(const T *up, const T *mid, const T *down, int j)
+{
+    return up[j] + down[j] + mid[j-1] + mid[j+1] +
+           up[j-1] + down[j+1] + up[j+1] + down[j-1] -
+           8 * mid[j];
+}
+
+template<class T>
+static inline T laplace7(const T *up, const T *mid, const T *down, const T *below, const T *above, int j)
+{
+    return up[j] + down[j] + mid[j-1] + mid[j+1] + below[j] + above[j] - 6 * mid[j];
+}
+
+template<class T>
+static void laplaceRowScalar(const T *up, const T *mid, const T *down, T *out, int n)
+{
+    for(int j = 1; j < n - 1; j++)
+        out[j] = laplace(up, mid, down, j);
+}
+
+template<class T>
+static void updateRowScalar(const T *up, const T *mid, const T *down, const T *r, T *out, int n, T c, T dt)
+{
+    for(int j = 1; j < n - 1; j++)
+        out[j] = mid[j] + dt * (c * laplace(up, mid, down, j) + r[j]);
+}
+
+template<class T>
+static void volumeRowScalar(const T *up, const T *mid, const T *down, const T *below, const T *above,
+                            const T *r, T *out, int n, T c, T dt)
+{
+    for(int j = 1; j < n - 1; j++)
+        out[j] = mid[j] + dt * (c * laplace7(up, mid, down, below, above, j) + r[j]);
+}
+
+// S wraps one vector register type, the scalar loop handles the tail
+template<class S, class T>
+static inline void laplaceRowSimd(const T *up, const T *mid, const T *down, T *out, int n)
+{
+    typedef typename S::Vec Vec;
+    const Vec eight = S::set1(8);
+
+    int j = 1;
+    for(; j + S::width <= n - 1; j += S::width)
+    {
+        Vec lap = S::add(S::load(up + j), S::load(down + j));
+        lap = S::add(lap, S::load(mid + j - 1));
+        lap = S::add(lap, S::load(mid + j + 1));
+        lap = S::add(lap, S::load(up + j - 1));
+        lap = S::add(lap, S::load(down + j + 1));
+        lap = S::add(lap, S::load(up + j + 1));
+        lap = S::add(lap, S::load(down + j - 1));
+        lap = S::sub(lap, S::mul(eight, S::load(mid + j)));
+        S::store(out + j, lap);
+    }
+
+    for(; j < n - 1; j++)
+        out[j] = laplace(up, mid, down, j);
+}
+
+template<class S, class T>
+static inline void updateRowSimd(const T *up, const T *mid, const T *down, const T *r, T *out, int n, T c, T dt)
+{
+    typedef typename S::Vec Vec;
+    const Vec eight = S::set1(8), vc = S::set1(c), vdt = S::set1(dt);
+
+    int j = 1;
+    for(; j + S::width <= n - 1; j += S::width)
+    {
+        Vec lap = S::add(S::load(up + j), S::load(down + j));
+        lap = S::add(lap, S::load(mid + j - 1));
+        lap = S::add(lap, S::load(mid + j + 1));
+        lap = S::add(lap, S::load(up + j - 1));
+        lap = S::add(lap, S::load(down + j + 1));
+        lap = S::add(lap, S::load(up + j + 1));
+        lap = S::add(lap, S::load(down + j - 1));
+        lap = S::sub(lap, S::mul(eight, S::load(mid + j)));
+
+        Vec rate = S::add(S::mul(vc, lap), S::load(r + j));
+        S::store(out + j, S::add(S::load(mid + j), S::mul(vdt, rate)));
+    }
+
+    for(; j < n - 1; j++)
+        out[j] = mid[j] + dt * (c * laplace(up, mid, down, j) + r[j]);
+}
+
+template<class S, class T>
+static inline void volumeRowSimd(const T *up, const T *mid, const T *down, const T *below, const T *above,
+                                 const T *r, T *out, int n, T c, T dt)
+{
+    typedef typename S::Vec Vec;
+    const Vec six = S::set1(6), vc = S::set1(c), vdt = S::set1(dt);
+
+    int j = 1;
+    for(; j + S::width <= n - 1; j += S::width)
+    {
+        Vec lap = S::add(S::load(up + j), S::load(down + j));
+        lap = S::add(lap, S::load(mid + j - 1));
+        lap = S::add(lap, S::load(mid + j + 1));
+        lap = S::add(lap, S::load(below + j));
+        lap = S::add(lap, S::load(above + j));
+        lap = S::sub(lap, S::mul(six, S::load(mid + j)));
+
+        Vec rate = S::add(S::mul(vc, lap), S::load(r + j));
+        S::store(out + j, S::add(S::load(mid + j), S::mul(vdt, rate)));
+    }
+
+    for(; j < n - 1; j++)
+        out[j] = mid[j] + dt * (c * laplace7(up, mid, down, below, above, j) + r[j]);
+}
+
+#ifdef KERNELS_X86
+
+struct SSE2Double
+{
+    typedef __m128d Vec;
+    enum { width = 2 };
+
+    HELPER_TARGET("sse2") static inline Vec load(const double *p) { return _mm_loadu_pd(p); }
+    HELPER_TARGET("sse2") static inline void store(double *p, Vec a) { _mm_storeu_pd(p, a); }
+    HELPER_TARGET("sse2") static inline Vec set1(double a) { return _mm_set1_pd(a); }
+    HELPER_TARGET("sse2") static inline Vec add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+    HELPER_TARGET("sse2") static inline Vec sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+    HELPER_TARGET("sse2") static inline Vec mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+};
+
+struct AVX2Double
+{
+    typedef __m256d Vec;
+    enum { width = 4 };
+
+    HELPER_TARGET("avx2") static inline Vec load(const double *p) { return _mm256_loadu_pd(p); }
+    HELPER_TARGET("avx2") static inline void store(double *p, Vec a) { _mm256_storeu_pd(p, a); }
+    HELPER_TARGET("avx2") static inline Vec set1(double a) { return _mm256_set1_pd(a); }
+    HELPER_TARGET("avx2") static inline Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+    HELPER_TARGET("avx2") static inline Vec sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+    HELPER_TARGET("avx2") static inline Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+};
+
+struct AVX512Double
+{
+    typedef __m512d Vec;
+    enum { width = 8 };
+
+    HELPER_TARGET("avx512f") static inline Vec load(const double *p) { return _mm512_loadu_pd(p); }
+    HELPER_TARGET("avx512f") static inline void store(double *p, Vec a) { _mm512_storeu_pd(p, a); }
+    HELPER_TARGET("avx512f") static inline Vec set1(double a) { return _mm512_set1_pd(a); }
+    HELPER_TARGET("avx512f") static inline Vec add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+    HELPER_TARGET("avx512f") static inline Vec sub(Vec a, Vec b) { return _mm512_sub_pd(a, b); }
+    HELPER_TARGET("avx512f") static inline Vec mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+};
+
+struct SSE2Float
+{
+    typedef __m128 Vec;
+    enum { width = 4 };
+
+    HELPER_TARGET("sse2") static inline Vec load(const float *p) { return _mm_loadu_ps(p); }
+    HELPER_TARGET("sse2") static inline void store(float *p, Vec a) { _mm_storeu_ps(p, a); }
+    HELPER_TARGET("sse2") static inline Vec set1(float a) { return _mm_set1_ps(a); }
+    HELPER_TARGET("sse2") static inline Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+    HELPER_TARGET("sse2") static inline Vec sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+    HELPER_TARGET("sse2") static inline Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+};
+
+struct AVX2Float
+{
+    typedef __m256 Vec;
+    enum { width = 8 };
+
+    HELPER_TARGET("avx2") static inline Vec load(const float *p) { return _mm256_loadu_ps(p); }
+    HELPER_TARGET("avx2") static inline void store(float *p, Vec a) { _mm256_storeu_ps(p, a); }
+    HELPER_TARGET("avx2") static inline Vec set1(float a) { return _mm256_set1_ps(a); }
+    HELPER_TARGET("avx2") static inline Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+    HELPER_TARGET("avx2") static inline Vec sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+    HELPER_TARGET("avx2") static inline Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+};
+
+struct AVX512Float
+{
+    typedef __m512 Vec;
+    enum { width = 16 };
+
+    HELPER_TARGET("avx512f") static inline Vec load(const float *p) { return _mm512_loadu_ps(p); }
+    HELPER_TARGET("avx512f") static inline void store(float *p, Vec a) { _mm512_storeu_ps(p, a); }
+    HELPER_TARGET("avx512f") static inline Vec set1(float a) { return _mm512_set1_ps(a); }
+    HELPER_TARGET("avx512f") static inline Vec add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+    HELPER_TARGET("avx512f") static inline Vec sub(Vec a, Vec b) { return _mm512_sub_ps(a, b); }
+    HELPER_TARGET("avx512f") static inline Vec mul(Vec a, Vec b) { return _mm512_mul_ps(a, b); }
+};
+
+// entry points compiled for each instruction set
+#define DEFINE_KERNELS(NAME, ISA, S, T) \
+    KERNEL_TARGET(ISA) static void laplaceRow##NAME(const T *up, const T *mid, const T *down, T *out, int n) \
+    { laplaceRowSimd<S>(up, mid, down, out, n); } \
+    KERNEL_TARGET(ISA) static void updateRow##NAME(const T *up, const T *mid, const T *down, const T *r, T *out, int n, T c, T dt) \
+    { updateRowSimd<S>(up, mid, down, r, out, n, c, dt); } \
+    KERNEL_TARGET(ISA) static void volumeRow##NAME(const T *up, const T *mid, const T *down, const T *below, \
+                                                   const T *above, const T *r, T *out, int n, T c, T dt) \
+    { volumeRowSimd<S>(up, mid, down, below, above, r, out, n, c, dt); }
+
+DEFINE_KERNELS(SSE2Double, "sse2", SSE2Double, double)
+DEFINE_KERNELS(AVX2Double, "avx2", AVX2Double, double)
+DEFINE_KERNELS(AVX512Double, "avx512f", AVX512Double, double)
+DEFINE_KERNELS(SSE2Float, "sse2", SSE2Float, float)
+DEFINE_KERNELS(AVX2Float, "avx2", AVX2Float, float)
+DEFINE_KERNELS(AVX512Float, "avx512f", AVX512Float, float)
+
+#endif
+
+SimdLevel detectSimdLevel()
+{
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return SimdAVX512;
+    if(__builtin_cpu_supports("avx2"))
+        return SimdAVX2;
+    if(__builtin_cpu_supports("sse2"))
+        return SimdSSE2;
+#endif
+    return SimdScalar;
+}
+
+const char *simdLevelName(SimdLevel level)
+{
+    switch(level)
+    {
+    case SimdSSE2: return "SSE2";
+    case SimdAVX2: return "AVX2";
+    case SimdAVX512: return "AVX-512";
+    default: return "scalar";
+    }
+}
+
+#ifdef KERNELS_X86
+#define SELECT_KERNELS(k, level, T) \
+    switch(level) \
+    { \
+    case SimdAVX512: \
+        k.laplaceRow = laplaceRowAVX512##T; k.updateRow = updateRowAVX512##T; k.volumeRow = volumeRowAVX512##T; break; \
+    case SimdAVX2: \
+        k.laplaceRow = laplaceRowAVX2##T; k.updateRow = updateRowAVX2##T; k.volumeRow = volumeRowAVX2##T; break; \
+    case SimdSSE2: \
+        k.laplaceRow = laplaceRowSSE2##T; k.updateRow = updateRowSSE2##T; k.volumeRow = volumeRowSSE2##T; break; \
+    default: break; \
+    }
+#else
+#define SELECT_KERNELS(k, level, T) (void)level;
+#endif
+
+template<>
+Kernels<double> kernels<double>(SimdLevel level)
+{
+    Kernels<double> k = {laplaceRowScalar<double>, updateRowScalar<double>, volumeRowScalar<double>};
+    SELECT_KERNELS(k, level, Double)
+    return k;
+}
+
+template<>
+Kernels<float> kernels<float>(SimdLevel level)
+{
+    Kernels<float> k = {laplaceRowScalar<float>, updateRowScalar<float>, volumeRowScalar<float>};
+    SELECT_KERNELS(k, level, Float)
+    return k;
+}
+
+FlushDenormals::FlushDenormals(bool enabled) : m_saved(0), m_enabled(enabled)
+{
+#ifdef KERNELS_X86
+    if(m_enabled)
+    {
+        // flush-to-zero and denormals-are-zero
+        m_saved = _mm_getcsr();
+        _mm_setcsr(m_saved | 0x8040);
+    }
+#endif
+}
+
+FlushDenormals::~FlushDenormals()
+{
+#ifdef KERNELS_X86
+    if(m_enabled)
+        _mm_setcsr(m_saved);
+#endif
+}
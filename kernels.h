@@ -0,0 +1,52 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+// Row kernels of the explicit solver. Every variant performs the same
+// operations in the same order as the scalar one, so they all produce
+// bitwise identical results.
+
+enum SimdLevel
+{
+    SimdScalar,
+    SimdSSE2,
+    SimdAVX2,
+    SimdAVX512
+};
+
+template<class T>
+struct Kernels
+{
+    // out[j] = 9-point laplacian of mid[j], for j in [1, n - 1)
+    void (*laplaceRow)(const T *up, const T *mid, const T *down, T *out, int n);
+
+    // out[j] = mid[j] + dt * (c * laplacian + r[j]), for j in [1, n - 1)
+    void (*updateRow)(const T *up, const T *mid, const T *down, const T *r, T *out, int n, T c, T dt);
+
+    // same with the 7-point laplacian of a volume, below and above are the
+    // rows of mid in the neighbouring planes
+    void (*volumeRow)(const T *up, const T *mid, const T *down, const T *below, const T *above,
+                      const T *r, T *out, int n, T c, T dt);
+};
+
+// best level supported by the running CPU
+SimdLevel detectSimdLevel();
+const char *simdLevelName(SimdLevel level);
+
+template<class T>
+Kernels<T> kernels(SimdLevel level);
+
+// Treats denormal numbers as zero in the calling thread while in scope.
+// Single precision underflows quickly in the tails of the fields, and
+// denormal arithmetic is many times slower than the normal one
+class FlushDenormals
+{
+public:
+    explicit FlushDenormals(bool enabled = true);
+    ~FlushDenormals();
+
+private:
+    unsigned m_saved;
+    bool m_enabled;
+};
+
+#endif // KERNELS_H
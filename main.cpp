@@ -2,16 +2,46 @@
 #include <QApplication>
 #include <QSurfaceFormat>
 
+#ifdef HAVE_MPI
+#include "distributedsolver.h"
+#endif
+
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
+#ifdef HAVE_MPI
+    // under mpirun the first rank shows the window and the others step
+    // their blocks of the field along with it
+    MPI_Init(&argc, &argv);
+    int rank = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank != 0)
+    {
+        {
+            DistributedSolver solver;
+            solver.serve();
+        }
+        MPI_Finalize();
+        return 0;
+    }
+#endif
+
+    int result;
+    {
+        QApplication a(argc, argv);
+
+        QSurfaceFormat format;
+        format.setDepthBufferSize(24);
+        QSurfaceFormat::setDefaultFormat(format);
 
-    QSurfaceFormat format;
-    format.setDepthBufferSize(24);
-    QSurfaceFormat::setDefaultFormat(format);
+        MainWindow w;
+        w.show();
 
-    MainWindow w;
-    w.show();
+        result = a.exec();
+    }
 
-    return a.exec();
+#ifdef HAVE_MPI
+    // the window let the other ranks go when it was destroyed
+    MPI_Finalize();
+#endif
+    return result;
 }
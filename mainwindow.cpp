@@ -14,17 +14,44 @@
 #include <QInputDialog>
 #include <QStandardPaths>
 #include <QDoubleSpinBox>
+#include <QComboBox>
+#include <QHBoxLayout>
+#include <QImage>
+#include <QThread>
 
 #include <map>
+#include <cmath>
 
 using namespace  std;
 
+// entries of the field chooser of a parameter
+enum ParamSource
+{
+    SourceValue,
+    SourceRampAcross,
+    SourceRampDown,
+    SourceImage
+};
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
     layout(new QFormLayout())
 {
     ui->setupUi(this);
+    ui->threads->setValue(QThread::idealThreadCount());
+
+    QString kernelsPath = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QDir::separator() + QString("kernels");
+    QDir().mkpath(kernelsPath);
+    ui->rdWidget->solver()->setKernelCacheDir(kernelsPath.toStdString());
+    connect(ui->rdWidget, &RDWidget::advanced, this, &MainWindow::updateStepInfo);
+
+    // the stages of the split integrator are applied as they are edited
+    connect(ui->splitDiffusion, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::applySplitStages);
+    connect(ui->splitReaction, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::applySplitStages);
+    connect(ui->diffusionSteps, QOverload<int>::of(&QSpinBox::valueChanged), this, &MainWindow::applySplitStages);
+    connect(ui->reactionSteps, QOverload<int>::of(&QSpinBox::valueChanged), this, &MainWindow::applySplitStages);
+
     loadModels();
 }
 
@@ -55,6 +82,11 @@ void MainWindow::on_gridSize_editingFinished()
     init();
 }
 
+void MainWindow::on_gridHeight_editingFinished()
+{
+    init();
+}
+
 void MainWindow::on_dt_editingFinished()
 {
     float dt = ui->dt->value();
@@ -84,9 +116,24 @@ void MainWindow::init()
 {
     ui->rdWidget->stop();
 
-    int size = ui->gridSize->value();
+    int width = ui->gridSize->value();
+    int height = ui->gridHeight->value();
     float dt = ui->dt->value();
-    ui->rdWidget->init(size, dt);
+    ui->rdWidget->setThreadCount(ui->threads->value());
+    ui->rdWidget->solver()->setPrecision(ui->precision->currentIndex() == 1 ? PrecisionFloat : PrecisionDouble);
+    ui->rdWidget->solver()->setIntegrator((Integrator)ui->integrator->currentIndex());
+    ui->rdWidget->solver()->setTolerance(ui->tolerance->value());
+    ui->rdWidget->solver()->setActiveTolerance(ui->activeTolerance->value());
+    ui->rdWidget->solver()->setBoundaryCondition((BoundaryCondition)ui->boundary->currentIndex());
+    ui->rdWidget->solver()->setNormalization((Normalization)ui->normalization->currentIndex());
+    ui->rdWidget->solver()->setSteadyTolerance(ui->steadyTolerance->value());
+    ui->rdWidget->setStopWhenSteady(ui->steadyAction->currentIndex() == 0);
+    ui->rdWidget->solver()->setDimensions(ui->dimensions->currentIndex() + 2);
+    ui->rdWidget->solver()->setSlice(ui->slice->value());
+    applySplitStages();
+    ui->rdWidget->init(width, height, dt);
+    applyAutoTimeStep();
+    updateStepInfo();
 }
 
 void MainWindow::loadModels()
@@ -152,6 +199,13 @@ void MainWindow::setModel(Model &model)
 {
     Solver *solver = ui->rdWidget->solver();
     solver->setModel(model);
+    updateKernelLabel();
+}
+
+void MainWindow::updateKernelLabel()
+{
+    Solver *solver = ui->rdWidget->solver();
+    ui->kernel->setText(tr("kernel: %1").arg(QString::fromStdString(solver->kernelName())));
 }
 
 void MainWindow::saveModel(const Model &model, const QString &modelName)
@@ -192,6 +246,15 @@ void MainWindow::saveModel(const Model &model, const QString &modelName)
         ++count;
     }
     settings.endArray();
+
+    settings.beginWriteArray("species");
+    for(size_t k = 0; k < model.species.size(); k++)
+    {
+        settings.setArrayIndex(k);
+        settings.setValue("name", QString::fromStdString(model.species[k].name));
+        settings.setValue("f", QString::fromStdString(model.species[k].f));
+    }
+    settings.endArray();
     settings.sync();
 
     loadModel(path);
@@ -221,6 +284,16 @@ void MainWindow::loadModel(QString fileName)
     }
     settings.endArray();
 
+    int species = settings.beginReadArray("species");
+    for (int i = 0; i < species; ++i) {
+        settings.setArrayIndex(i);
+
+        Species s = {settings.value("name").toString().toStdString(),
+                     settings.value("f").toString().toStdString()};
+        model.species.push_back(s);
+    }
+    settings.endArray();
+
     QString modelName = settings.value("name").toString();
     m_models.insert(modelName, model);
 
@@ -235,6 +308,11 @@ void MainWindow::clearCurrentModelLayout()
     for (int i = rows -1; i >= 0; --i)
         layout->removeRow(i);
     params.clear();
+    paramFields.clear();
+    speciesTerms.clear();
+
+    // the choosers of the next model start at single values
+    ui->rdWidget->solver()->clearParamFields();
 }
 
 void MainWindow::createModelLayout(Model &model)
@@ -257,12 +335,33 @@ void MainWindow::createModelLayout(Model &model)
 
         connect(spinbox,&QDoubleSpinBox::editingFinished,this,&MainWindow::updateModel);
 
+        // the value, or a field of values over the cells
+        QComboBox *source = new QComboBox();
+        source->addItems({tr("value"), tr("ramp across"), tr("ramp down"), tr("image...")});
+        connect(source,QOverload<int>::of(&QComboBox::activated),this,&MainWindow::bindParamField);
+
+        QHBoxLayout *row = new QHBoxLayout();
+        row->addWidget(spinbox);
+        row->addWidget(source);
+
         params.insert(label->text(), spinbox);
-        layout->addRow(label, spinbox);
+        paramFields.insert(label->text(), source);
+        layout->addRow(label, row);
 
         ++it;
     }
 
+    // the species after u and v, named by their variable
+    for(const Species &s : model.species)
+    {
+        QString name = QString::fromStdString(s.name);
+        QLineEdit *edit = new QLineEdit(QString::fromStdString(s.f));
+        connect(edit,&QLineEdit::editingFinished,this,&MainWindow::updateModel);
+
+        speciesTerms.insert(name, edit);
+        layout->addRow(new QLabel(tr("f%1").arg(name)), edit);
+    }
+
     ui->params->setLayout(layout);
 }
 
@@ -282,10 +381,68 @@ void MainWindow::updateModel()
 
     model->fu = ui->fu->text().toStdString();
     model->fv = ui->fv->text().toStdString();
+    for(Species &s : model->species)
+    {
+        QLineEdit *edit = speciesTerms.value(QString::fromStdString(s.name));
+        if(edit)
+            s.f = edit->text().toStdString();
+    }
 
     setModel(*model);
 }
 
+// Ramps go from the minimum of the parameter to its maximum, images are
+// taken in gray levels from black at the minimum to white at the maximum
+void MainWindow::bindParamField(int index)
+{
+    QComboBox *source = qobject_cast<QComboBox*>(sender());
+    QString name = paramFields.key(source);
+    QDoubleSpinBox *spinbox = params.value(name);
+    if(!spinbox)
+        return;
+
+    Solver *solver = ui->rdWidget->solver();
+    string param = name.toStdString();
+    double low = spinbox->minimum(), high = spinbox->maximum();
+
+    switch(index)
+    {
+    case SourceRampAcross:
+        solver->setParamRamp(param, low, high, RampHorizontal);
+        break;
+    case SourceRampDown:
+        solver->setParamRamp(param, low, high, RampVertical);
+        break;
+    case SourceImage:
+    {
+        QString fileName = QFileDialog::getOpenFileName(this, tr("Parameter Field"), QString(),
+                                                        tr("Images (*.png *.jpg *.bmp *.pgm)"));
+        QImage image = fileName.isEmpty() ? QImage() : QImage(fileName).convertToFormat(QImage::Format_Grayscale8);
+        if(image.isNull())
+        {
+            source->setCurrentIndex(SourceValue);
+            solver->setParamField(param, Matrix<double>());
+            break;
+        }
+
+        Matrix<double> values(image.height(), image.width());
+        for(int i = 0; i < image.height(); i++)
+        {
+            const uchar *line = image.constScanLine(i);
+            for(int j = 0; j < image.width(); j++)
+                values(i,j) = low + (high - low) * line[j] / 255.0;
+        }
+        solver->setParamField(param, values);
+        break;
+    }
+    default:
+        solver->setParamField(param, Matrix<double>());
+        break;
+    }
+
+    updateKernelLabel();
+}
+
 void MainWindow::on_models_currentTextChanged(const QString &arg1)
 {
     Model model = m_models[arg1];
@@ -332,6 +489,112 @@ void MainWindow::on_skipFrames_editingFinished()
     ui->rdWidget->setFramesToSkip(ui->skipFrames->value());
 }
 
+void MainWindow::on_threads_editingFinished()
+{
+    ui->rdWidget->setThreadCount(ui->threads->value());
+}
+
+void MainWindow::on_native_toggled(bool checked)
+{
+    Solver *solver = ui->rdWidget->solver();
+    solver->setNativeKernels(checked);
+    updateKernelLabel();
+
+    if(checked && !solver->isNative() && solver->reaction() == ReactionExpression)
+        QMessageBox::information(this, tr("Native kernels"),
+                                 tr("The reaction terms could not be compiled, the interpreter will be used instead."));
+}
+
+void MainWindow::on_integrator_currentIndexChanged(int index)
+{
+    ui->rdWidget->solver()->setIntegrator((Integrator)index);
+}
+
+void MainWindow::on_tolerance_editingFinished()
+{
+    ui->rdWidget->solver()->setTolerance(ui->tolerance->value());
+}
+
+void MainWindow::on_activeTolerance_editingFinished()
+{
+    ui->rdWidget->solver()->setActiveTolerance(ui->activeTolerance->value());
+}
+
+void MainWindow::on_boundary_currentIndexChanged(int index)
+{
+    ui->rdWidget->solver()->setBoundaryCondition((BoundaryCondition)index);
+}
+
+void MainWindow::on_normalization_currentIndexChanged(int index)
+{
+    ui->rdWidget->solver()->setNormalization((Normalization)index);
+}
+
+void MainWindow::on_steadyTolerance_editingFinished()
+{
+    ui->rdWidget->solver()->setSteadyTolerance(ui->steadyTolerance->value());
+}
+
+void MainWindow::on_steadyAction_currentIndexChanged(int index)
+{
+    ui->rdWidget->setStopWhenSteady(index == 0);
+}
+
+void MainWindow::on_dimensions_currentIndexChanged(int)
+{
+    init();
+}
+
+void MainWindow::on_slice_valueChanged(int value)
+{
+    ui->rdWidget->setSlice(value);
+}
+
+void MainWindow::applySplitStages()
+{
+    Solver *solver = ui->rdWidget->solver();
+    solver->setDiffusionStage((SplitDiffusion)ui->splitDiffusion->currentIndex(), ui->diffusionSteps->value());
+    solver->setReactionStage((SplitReaction)ui->splitReaction->currentIndex(), ui->reactionSteps->value());
+}
+
+void MainWindow::on_autoDt_toggled(bool checked)
+{
+    ui->dt->setEnabled(!checked);
+    applyAutoTimeStep();
+}
+
+void MainWindow::on_safety_editingFinished()
+{
+    applyAutoTimeStep();
+}
+
+void MainWindow::applyAutoTimeStep()
+{
+    Solver *solver = ui->rdWidget->solver();
+    solver->setAutoTimeStep(ui->autoDt->isChecked() ? ui->safety->value() : 0);
+    if(!ui->autoDt->isChecked())
+        solver->setTimeStep(ui->dt->value());
+}
+
+void MainWindow::updateStepInfo()
+{
+    Solver *solver = ui->rdWidget->solver();
+    QString info = tr("dt: %1  t: %2").arg(solver->stepSize(), 0, 'g', 4).arg(solver->time(), 0, 'f', 1);
+    if(solver->activeTolerance() > 0 && solver->integrator() == IntegratorExplicit)
+        info += tr("  active: %1%").arg(100 * solver->activeFraction(), 0, 'f', 0);
+    if(std::isfinite(solver->rate()))
+        info += tr("  rate: %1").arg(solver->rate(), 0, 'g', 3);
+    if(solver->isSteady())
+        info += tr("  steady");
+    ui->stepInfo->setText(info);
+}
+
+void MainWindow::on_precision_currentIndexChanged(int index)
+{
+    ui->rdWidget->solver()->setPrecision(index == 1 ? PrecisionFloat : PrecisionDouble);
+    updateKernelLabel();
+}
+
 void MainWindow::on_render_clicked()
 {
     Surface surf = ui->rdWidget->surface();
@@ -4,6 +4,8 @@
 #include <QMainWindow>
 #include <QFormLayout>
 #include <QDoubleSpinBox>
+#include <QLineEdit>
+#include <QComboBox>
 
 #include "solver.h"
 
@@ -28,12 +30,30 @@ private slots:
     void on_loadModel_clicked();
 
     void on_gridSize_editingFinished();
+    void on_gridHeight_editingFinished();
     void on_dt_editingFinished();
     void on_models_currentTextChanged(const QString &arg1);
 
     void updateModel();
 
     void on_skipFrames_editingFinished();
+    void on_threads_editingFinished();
+    void on_native_toggled(bool checked);
+    void on_precision_currentIndexChanged(int index);
+    void on_integrator_currentIndexChanged(int index);
+    void on_tolerance_editingFinished();
+    void on_activeTolerance_editingFinished();
+    void on_boundary_currentIndexChanged(int index);
+    void on_normalization_currentIndexChanged(int index);
+    void on_steadyTolerance_editingFinished();
+    void on_steadyAction_currentIndexChanged(int index);
+    void on_dimensions_currentIndexChanged(int index);
+    void on_slice_valueChanged(int value);
+    void on_autoDt_toggled(bool checked);
+    void applySplitStages();
+    void on_safety_editingFinished();
+    void updateStepInfo();
+    void bindParamField(int index);
 
     void on_render_clicked();
 
@@ -44,6 +64,8 @@ private:
     void init();
     void loadModels();
     void setModel(Model &model);
+    void updateKernelLabel();
+    void applyAutoTimeStep();
     void saveModel(const Model &model, const QString &modelName);
     void loadModel(QString fileName);
     void clearCurrentModelLayout();
@@ -53,6 +75,10 @@ private:
     QFormLayout *layout;
 
     QMap<QString, QDoubleSpinBox*> params;
+    // single value or field of every parameter, by parameter name
+    QMap<QString, QComboBox*> paramFields;
+    // reaction terms of the species after u and v, by species name
+    QMap<QString, QLineEdit*> speciesTerms;
     QHash<QString, Model> m_models;
 };
 
@@ -2,27 +2,104 @@
 #define MATRIX_H
 
 #include <vector>
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// rows are aligned to a cache line, which also covers AVX-512 loads
+const std::size_t MATRIX_ALIGNMENT = 64;
 
+template<class T>
+class AlignedAllocator
+{
+public:
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template<class U> AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T* allocate(std::size_t n)
+    {
+#ifdef _WIN32
+        void *ptr = _aligned_malloc(n * sizeof(T), MATRIX_ALIGNMENT);
+        if(!ptr)
+            throw std::bad_alloc();
+#else
+        void *ptr = nullptr;
+        if(posix_memalign(&ptr, MATRIX_ALIGNMENT, n * sizeof(T)) != 0)
+            throw std::bad_alloc();
+#endif
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t)
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    template<class U> struct rebind { typedef AlignedAllocator<U> other; };
+};
+
+template<class T, class U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return true; }
+template<class T, class U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return false; }
+
+// Dense row-major matrix stored in one contiguous buffer. Each row starts on
+// a MATRIX_ALIGNMENT boundary, so the distance between rows (stride) can be
+// larger than cols.
 template<class T>
 class Matrix
 {
 public:
-    Matrix() : rows(0), cols(0) {}
-    Matrix(const int r, const int c) : rows(r), cols(c)
+    Matrix() : rows(0), cols(0), stride(0) {}
+    Matrix(const int r, const int c) : rows(r), cols(c), stride(paddedStride(c))
     {
-        m_data.resize(r * c);
+        m_data.resize(r * stride);
     }
 
     T& operator()(const int &i, const int &j)
     {
-        return m_data[i * cols + j];
+        return m_data[i * stride + j];
+    }
+
+    const T& operator()(const int &i, const int &j) const
+    {
+        return m_data[i * stride + j];
+    }
+
+    T* row(const int &i)
+    {
+        return m_data.data() + i * stride;
+    }
+
+    const T* row(const int &i) const
+    {
+        return m_data.data() + i * stride;
     }
 
     void fill(const T &val)
     {
         for(int i = 0; i < rows; i++)
             for(int j = 0; j < cols; j++)
-                m_data[i * cols + j] = val;
+                m_data[i * stride + j] = val;
+    }
+
+    // exchanges buffers without copying any element
+    void swap(Matrix &other)
+    {
+        std::swap(rows, other.rows);
+        std::swap(cols, other.cols);
+        std::swap(stride, other.stride);
+        m_data.swap(other.m_data);
     }
 
     T* data()
@@ -30,10 +107,21 @@ public:
         return m_data.data();
     }
 
-    int rows, cols;
+    const T* data() const
+    {
+        return m_data.data();
+    }
+
+    int rows, cols, stride;
 
 private:
-    std::vector<T> m_data;
+    static int paddedStride(int c)
+    {
+        const int step = MATRIX_ALIGNMENT / sizeof(T);
+        return (c + step - 1) / step * step;
+    }
+
+    std::vector<T, AlignedAllocator<T>> m_data;
 };
 
 #endif // MATRIX_H
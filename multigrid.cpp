@@ -0,0 +1,401 @@
+#include "multigrid.h"
+#include "kernels.h"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+// smoothing sweeps before and after the coarse grid correction
+static const int PRE_SWEEPS = 2;
+static const int POST_SWEEPS = 2;
+// Jacobi damping, smooths the high frequencies of the 9-point stencil
+static const double OMEGA = 0.8;
+static const int COARSEST = 4;
+static const int MAX_CYCLES = 30;
+
+// interior rows [1, rows] split in bands, task(begin, end, thread)
+template<class T, class F>
+static void parallelRows(ThreadPool &pool, int rows, const F &task)
+{
+    int bands = max(1, min(pool.size(), rows));
+    pool.run(bands, [&task, rows, bands](int band, int thread) {
+        FlushDenormals flush(sizeof(T) == sizeof(float));
+        task(1 + band * rows / bands, 1 + (band + 1) * rows / bands, thread);
+    });
+}
+
+// largest residual accepted relative to the largest value of f. The
+// residual of u cannot be computed more accurately than the rounding of
+// the stencil, which grows with c
+template<class T>
+static double tolerance(T c)
+{
+    double tol = sizeof(T) == sizeof(float) ? 1e-5 : 1e-10;
+    return max(tol, 8 * numeric_limits<T>::epsilon() * (1 + 16 * (double)c));
+}
+
+template<class T>
+static inline T neighbours(const T *up, const T *mid, const T *down, int j)
+{
+    return up[j] + down[j] + mid[j-1] + mid[j+1] + up[j-1] + down[j+1] + up[j+1] + down[j-1];
+}
+
+template<class T>
+Multigrid<T>::Multigrid() : m_band(0), m_residual(0)
+{
+}
+
+template<class T>
+void Multigrid<T>::setup(int rows, int cols, T c)
+{
+    int count = 1;
+    for(int m = rows, n = cols; m > COARSEST && n > COARSEST; m = (m + 1) / 2, n = (n + 1) / 2)
+        count++;
+
+    if((int)m_levels.size() != count || m_levels[0].rows != rows || m_levels[0].cols != cols)
+    {
+        m_levels.assign(count, Level());
+        for(int k = 0, m = rows, n = cols; k < count; k++, m = (m + 1) / 2, n = (n + 1) / 2)
+        {
+            Level &l = m_levels[k];
+            l.rows = m;
+            l.cols = n;
+            l.u = Matrix<T>(m + 2, n + 2);
+            l.f = Matrix<T>(m + 2, n + 2);
+            l.r = Matrix<T>(m + 2, n + 2);
+            l.tmp = Matrix<T>(m + 2, n + 2);
+        }
+
+        for(int k = 0; k + 1 < count; k++)
+        {
+            Level &fine = m_levels[k], &coarse = m_levels[k + 1];
+            setupTransfer(fine.down, fine.rows, coarse.rows);
+            setupTransfer(fine.across, fine.cols, coarse.cols);
+        }
+    }
+
+    // c scales with 1 / h^2, the coarse cells are rows / m times taller
+    // and cols / n times wider, about the same
+    m_levels[0].c = c;
+    for(int k = 1; k < count; k++)
+    {
+        double down = (double)m_levels[k].rows / m_levels[k - 1].rows;
+        double across = (double)m_levels[k].cols / m_levels[k - 1].cols;
+        m_levels[k].c = m_levels[k - 1].c * down * across;
+    }
+
+    factorCoarsest();
+}
+
+template<class T>
+void Multigrid<T>::setupTransfer(Transfer &t, int n, int m)
+{
+    // the m coarse cells span the same length as the n fine ones, so for
+    // odd n they are slightly narrower than two fine cells and the grids
+    // do not nest. Positions are in units of coarse cells, centred on the
+    // coarse cell indices
+    t.lo.assign(n + 1, 0);
+    t.w.assign(n + 1, 0);
+    t.taps.assign(m + 1, vector<Tap>());
+
+    for(int i = 1; i <= n; i++)
+    {
+        double p = (i - 0.5) * m / n + 0.5;
+        int lo = min((int)p, m);
+        t.lo[i] = lo;
+        t.w[i] = p - lo;
+
+        // the restriction is the transpose of the interpolation, weights
+        // on the ghost cells fold back onto the edge cells
+        Tap a = {i, T(1 - (p - lo))}, b = {i, T(p - lo)};
+        t.taps[max(lo, 1)].push_back(a);
+        t.taps[min(lo + 1, m)].push_back(b);
+    }
+
+    // the coarse residual is a weighted mean of the fine ones
+    for(int k = 1; k <= m; k++)
+    {
+        T sum = 0;
+        for(const Tap &tap : t.taps[k])
+            sum += tap.w;
+        for(Tap &tap : t.taps[k])
+            tap.w /= sum;
+    }
+}
+
+// unknown of cell (i, j) of the coarsest level, numbered along the
+// shorter side so that the band of the system stays narrow
+static int unknown(int rows, int cols, int i, int j)
+{
+    return cols <= rows ? i * cols + j : j * rows + i;
+}
+
+template<class T>
+void Multigrid<T>::factorCoarsest()
+{
+    // the coarsest system is LU factored, with large c it is nearly
+    // singular and smoothing alone would not converge. Coarsening stops
+    // at the shorter side, so a long strip leaves many unknowns, but the
+    // neighbours of a cell are at most m_band unknowns away
+    const Level &l = m_levels.back();
+    int rows = l.rows, cols = l.cols, m = rows * cols;
+    int b = m_band = min(rows, cols) + 1, w = 2 * b + 1;
+    m_coarse.assign((size_t)m * w, 0);
+
+    // row r of the band holds the columns [r - b, r + b]
+    auto at = [this, b, w](int r, int c) -> double & { return m_coarse[(size_t)r * w + c - r + b]; };
+
+    for(int i = 0; i < rows; i++)
+    {
+        for(int j = 0; j < cols; j++)
+        {
+            int r = unknown(rows, cols, i, j);
+            // zero flux, a neighbour outside is the cell itself
+            for(int di = -1; di <= 1; di++)
+                for(int dj = -1; dj <= 1; dj++)
+                    if(di != 0 || dj != 0)
+                    {
+                        int ni = min(max(i + di, 0), rows - 1), nj = min(max(j + dj, 0), cols - 1);
+                        at(r, unknown(rows, cols, ni, nj)) -= l.c;
+                    }
+            at(r, r) += 1 + 8 * l.c;
+        }
+    }
+
+    // diagonally dominant, no pivoting needed, and the factors stay in
+    // the band
+    for(int k = 0; k < m; k++)
+        for(int r = k + 1; r <= min(m - 1, k + b); r++)
+        {
+            double f = at(r, k) /= at(k, k);
+            for(int c = k + 1; c <= min(m - 1, k + b); c++)
+                at(r, c) -= f * at(k, c);
+        }
+}
+
+template<class T>
+void Multigrid<T>::solveCoarsest(Level &l)
+{
+    int rows = l.rows, cols = l.cols, m = rows * cols;
+    int b = m_band, w = 2 * b + 1;
+    auto at = [this, b, w](int r, int c) { return m_coarse[(size_t)r * w + c - r + b]; };
+
+    vector<double> x(m);
+    for(int i = 0; i < rows; i++)
+        for(int j = 0; j < cols; j++)
+            x[unknown(rows, cols, i, j)] = l.f(i + 1, j + 1);
+
+    for(int k = 0; k < m; k++)
+        for(int c = max(0, k - b); c < k; c++)
+            x[k] -= at(k, c) * x[c];
+    for(int k = m - 1; k >= 0; k--)
+    {
+        for(int c = k + 1; c <= min(m - 1, k + b); c++)
+            x[k] -= at(k, c) * x[c];
+        x[k] /= at(k, k);
+    }
+
+    for(int i = 0; i < rows; i++)
+        for(int j = 0; j < cols; j++)
+            l.u(i + 1, j + 1) = x[unknown(rows, cols, i, j)];
+}
+
+template<class T>
+int Multigrid<T>::solve(Matrix<T> &u, Matrix<T> &f, ThreadPool &pool)
+{
+    Level &top = m_levels[0];
+
+    // the finest level works on the caller's buffers
+    top.u.swap(u);
+    top.f.swap(f);
+
+    double scale = maxAbs(top.f, top.rows, top.cols, pool);
+    int cycles = 0;
+
+    residual(top, pool);
+    m_residual = maxAbs(top.r, top.rows, top.cols, pool);
+
+    while(cycles < MAX_CYCLES && m_residual > tolerance(top.c) * scale)
+    {
+        vcycle(0, pool);
+        cycles++;
+
+        residual(top, pool);
+        m_residual = maxAbs(top.r, top.rows, top.cols, pool);
+    }
+
+    setBoundary(top.u, top.rows, top.cols);
+    top.u.swap(u);
+    top.f.swap(f);
+
+    return cycles;
+}
+
+template<class T>
+double Multigrid<T>::residual() const
+{
+    return m_residual;
+}
+
+template<class T>
+void Multigrid<T>::vcycle(int level, ThreadPool &pool)
+{
+    Level &l = m_levels[level];
+
+    if(level == (int)m_levels.size() - 1)
+    {
+        solveCoarsest(l);
+        return;
+    }
+
+    Level &coarse = m_levels[level + 1];
+
+    smooth(l, PRE_SWEEPS, pool);
+    residual(l, pool);
+    restrictResidual(l, coarse, pool);
+    coarse.u.fill(0);
+
+    vcycle(level + 1, pool);
+
+    prolongCorrection(coarse, l, pool);
+    smooth(l, POST_SWEEPS, pool);
+}
+
+template<class T>
+void Multigrid<T>::smooth(Level &l, int sweeps, ThreadPool &pool)
+{
+    T c = l.c, w = OMEGA / (1 + 8 * c), keep = 1 - OMEGA;
+
+    for(int s = 0; s < sweeps; s++)
+    {
+        setBoundary(l.u, l.rows, l.cols);
+
+        parallelRows<T>(pool, l.rows, [&l, c, w, keep](int begin, int end, int) {
+            for(int i = begin; i < end; i++)
+            {
+                const T *up = l.u.row(i-1), *mid = l.u.row(i), *down = l.u.row(i+1), *f = l.f.row(i);
+                T *out = l.tmp.row(i);
+                for(int j = 1; j <= l.cols; j++)
+                    out[j] = keep * mid[j] + w * (f[j] + c * neighbours(up, mid, down, j));
+            }
+        });
+
+        l.u.swap(l.tmp);
+    }
+}
+
+template<class T>
+void Multigrid<T>::residual(Level &l, ThreadPool &pool)
+{
+    T c = l.c, diag = 1 + 8 * c;
+    setBoundary(l.u, l.rows, l.cols);
+
+    parallelRows<T>(pool, l.rows, [&l, c, diag](int begin, int end, int) {
+        for(int i = begin; i < end; i++)
+        {
+            const T *up = l.u.row(i-1), *mid = l.u.row(i), *down = l.u.row(i+1), *f = l.f.row(i);
+            T *r = l.r.row(i);
+            for(int j = 1; j <= l.cols; j++)
+                r[j] = f[j] - (diag * mid[j] - c * neighbours(up, mid, down, j));
+        }
+    });
+}
+
+template<class T>
+void Multigrid<T>::restrictResidual(Level &fine, Level &coarse, ThreadPool &pool)
+{
+    // separable, along the rows into the first coarse.cols columns of
+    // tmp, then along the columns
+    parallelRows<T>(pool, fine.rows, [&fine, &coarse](int begin, int end, int) {
+        for(int i = begin; i < end; i++)
+        {
+            const T *src = fine.r.row(i);
+            T *dst = fine.tmp.row(i);
+            for(int j = 1; j <= coarse.cols; j++)
+            {
+                T sum = 0;
+                for(const Tap &t : fine.across.taps[j])
+                    sum += t.w * src[t.i];
+                dst[j] = sum;
+            }
+        }
+    });
+
+    parallelRows<T>(pool, coarse.rows, [&fine, &coarse](int begin, int end, int) {
+        for(int i = begin; i < end; i++)
+        {
+            T *dst = coarse.f.row(i);
+            for(int j = 1; j <= coarse.cols; j++)
+                dst[j] = 0;
+            for(const Tap &t : fine.down.taps[i])
+            {
+                const T *src = fine.tmp.row(t.i);
+                for(int j = 1; j <= coarse.cols; j++)
+                    dst[j] += t.w * src[j];
+            }
+        }
+    });
+}
+
+template<class T>
+void Multigrid<T>::prolongCorrection(Level &coarse, Level &fine, ThreadPool &pool)
+{
+    // bilinear between the coarse cell centres, the ghost cells give the
+    // zero flux edges
+    setBoundary(coarse.u, coarse.rows, coarse.cols);
+
+    parallelRows<T>(pool, fine.rows, [&fine, &coarse](int begin, int end, int) {
+        for(int i = begin; i < end; i++)
+        {
+            T wi = fine.down.w[i];
+            const T *a = coarse.u.row(fine.down.lo[i]), *b = coarse.u.row(fine.down.lo[i] + 1);
+            T *dst = fine.u.row(i);
+            for(int j = 1; j <= fine.cols; j++)
+            {
+                int lo = fine.across.lo[j];
+                T wj = fine.across.w[j];
+                T top = a[lo] + wj * (a[lo + 1] - a[lo]);
+                T bottom = b[lo] + wj * (b[lo + 1] - b[lo]);
+                dst[j] += top + wi * (bottom - top);
+            }
+        }
+    });
+}
+
+template<class T>
+void Multigrid<T>::setBoundary(Matrix<T> &w, int rows, int n)
+{
+    // zero flux, same order as Solver::setBoundary()
+    for(int i = 1; i <= rows; i++)
+    {
+        w(i,0) = w(i,1);
+        w(i,n + 1) = w(i,n);
+    }
+
+    for(int j = 0; j < n + 2; j++)
+    {
+        w(0,j) = w(1,j);
+        w(rows + 1,j) = w(rows,j);
+    }
+}
+
+template<class T>
+T Multigrid<T>::maxAbs(const Matrix<T> &w, int rows, int n, ThreadPool &pool)
+{
+    vector<T> partial(pool.size(), 0);
+
+    parallelRows<T>(pool, rows, [&w, &partial, n](int begin, int end, int thread) {
+        T m = partial[thread];
+        for(int i = begin; i < end; i++)
+            for(int j = 1; j <= n; j++)
+                m = max(m, (T)fabs(w(i,j)));
+        partial[thread] = m;
+    });
+
+    return *max_element(partial.begin(), partial.end());
+}
+
+template class Multigrid<double>;
+template class Multigrid<float>;
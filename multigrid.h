@@ -0,0 +1,81 @@
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#include <vector>
+
+#include "matrix.h"
+#include "threadpool.h"
+
+// Geometric multigrid for the implicit diffusion system of the solver,
+//   (1 + 8c) u(i,j) - c * (sum of the 8 neighbours of u(i,j)) = f(i,j)
+// that is (I - c * 3h^2 * laplacian) u = f with the 9-point laplacian of
+// Solver, on the interior cells of a field with zero flux edges. Every
+// level halves the number of cells per side, rounding up, until the
+// shorter side is small enough to solve directly. Corrections are
+// interpolated bilinearly and residuals restricted with the transpose.
+// Weighted Jacobi smooths every level and the coarsest one is solved
+// directly. Row bands run in parallel and the results do not depend on
+// the number of threads.
+template<class T>
+class Multigrid
+{
+public:
+    Multigrid();
+
+    // rows x cols interior cells
+    void setup(int rows, int cols, T c);
+
+    // solves in place, u holds the initial guess. Stops when the largest
+    // residual drops below tolerance times the largest value of f, and
+    // returns the number of V-cycles
+    int solve(Matrix<T> &u, Matrix<T> &f, ThreadPool &pool);
+
+    // largest residual after the last solve
+    double residual() const;
+
+private:
+    struct Tap
+    {
+        int i;
+        T w;
+    };
+
+    // transfer with the next coarser level along one axis. Fine cell i
+    // interpolates coarse cells lo[i] and lo[i] + 1 with weights 1 - w[i]
+    // and w[i], coarse cell k restricts the fine cells taps[k]
+    struct Transfer
+    {
+        std::vector<int> lo;
+        std::vector<T> w;
+        std::vector<std::vector<Tap>> taps;
+    };
+
+    struct Level
+    {
+        int rows, cols;
+        T c;
+        Matrix<T> u, f, r, tmp;
+        // along the columns (row index) and along the rows (column index)
+        Transfer down, across;
+    };
+
+    void vcycle(int level, ThreadPool &pool);
+    void smooth(Level &l, int sweeps, ThreadPool &pool);
+    void residual(Level &l, ThreadPool &pool);
+    static void setupTransfer(Transfer &t, int n, int m);
+    void restrictResidual(Level &fine, Level &coarse, ThreadPool &pool);
+    void prolongCorrection(Level &coarse, Level &fine, ThreadPool &pool);
+    void factorCoarsest();
+    void solveCoarsest(Level &l);
+    static void setBoundary(Matrix<T> &w, int rows, int cols);
+    static T maxAbs(const Matrix<T> &w, int rows, int cols, ThreadPool &pool);
+
+    std::vector<Level> m_levels;
+    // banded LU factors of the coarsest level, and the half width of
+    // the band
+    std::vector<double> m_coarse;
+    int m_band;
+    double m_residual;
+};
+
+#endif // MULTIGRID_H
@@ -6,43 +6,71 @@
 RDWidget::RDWidget(QWidget *parent) :
     GLWidget(parent),
     isActive(false),
-    frame(0),
-    m_framesToSkip(10)
+    m_framesToSkip(10),
+    m_stopWhenSteady(true),
+    m_steady(false)
 {
-
+#ifdef HAVE_MPI
+    // the other ranks follow the calls of this one in serve()
+    int initialized = 0, ranks = 1;
+    MPI_Initialized(&initialized);
+    if(initialized)
+        MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    m_distributed = ranks > 1 ? new DistributedSolver() : 0;
+    if(m_distributed)
+        m_distributed->lead();
+#endif
 }
 
 RDWidget::~RDWidget()
 {
-
+#ifdef HAVE_MPI
+    delete m_distributed;
+#endif
 }
 
 Solver *RDWidget::solver()
 {
+#ifdef HAVE_MPI
+    if(m_distributed)
+        return m_distributed->solver();
+#endif
     return &m_solver;
 }
 
-void RDWidget::init(int size, double dt)
+void RDWidget::init(int width, int height, double dt)
 {
 //    u = Matrix(size,size);
 //    u0 = Matrix(size,size);
 //    v = Matrix(size,size);
 //    v0 = Matrix(size,size);
 
-    setSize(size);
+    setSize(width, height);
     setTimeStep(dt);
     draw();
 }
 
-void RDWidget::setSize(int size)
+void RDWidget::setSize(int width, int height)
 {
-    m_solver.setSize(size);
-    m_pixmap = QPixmap(size, size);
+#ifdef HAVE_MPI
+    if(m_distributed)
+    {
+        m_distributed->setSize(width, height);
+        m_distributed->updateLimits();
+        m_distributed->gather(m_field);
+        m_pixmap = QPixmap(fieldWidth(), fieldHeight());
+        return;
+    }
+#endif
+
+    // a volume is a cube, the solver settles the height
+    m_solver.setSize(width, height);
+    m_pixmap = QPixmap(m_solver.width, m_solver.height);
 }
 
 void RDWidget::setTimeStep(double dt)
 {
-    m_solver.setTimeStep(dt);
+    solver()->setTimeStep(dt);
 }
 
 void RDWidget::setFramesToSkip(uint frames)
@@ -50,6 +78,22 @@ void RDWidget::setFramesToSkip(uint frames)
     m_framesToSkip = frames;
 }
 
+void RDWidget::setThreadCount(int threads)
+{
+    solver()->setThreadCount(threads);
+}
+
+void RDWidget::setStopWhenSteady(bool stop)
+{
+    m_stopWhenSteady = stop;
+}
+
+void RDWidget::setSlice(int slice)
+{
+    solver()->setSlice(slice);
+    draw();
+}
+
 void RDWidget::start()
 {
     if(isActive)
@@ -69,11 +113,36 @@ void RDWidget::render()
     if(!isActive)
         return;
 
-    m_solver.solve();
-    if((++frame)%m_framesToSkip == 0)
+    // frames in between are never shown, so they are advanced in one
+    // batch that the solver can tile in time. The color range is only
+    // needed for the frames that are drawn
+    bool converged;
+#ifdef HAVE_MPI
+    if(m_distributed)
+    {
+        m_distributed->solve(qMax(1, int(m_framesToSkip)));
+        m_distributed->updateLimits();
+        m_distributed->gather(m_field);
+        converged = m_distributed->isSteady();
+    }
+    else
+#endif
+    {
+        m_solver.solve(qMax(1, int(m_framesToSkip)));
+        m_solver.updateLimits();
+        converged = m_solver.isSteady();
+    }
+    draw();
+    emit advanced();
+
+    if(converged && !m_steady)
+        emit steady();
+    m_steady = converged;
+
+    if(converged && m_stopWhenSteady)
     {
-        frame = 0;
-        draw();
+        isActive = false;
+        return;
     }
 
     QTimer::singleShot(1, this, &RDWidget::render);
@@ -81,14 +150,17 @@ void RDWidget::render()
 
 void RDWidget::draw()
 {
-    int size = m_solver.size;
+    // a uniform field has an empty range
+    const Solver *s = solver();
+    double range = s->maxu > s->minu ? s->maxu - s->minu : 1;
 
+    // rows of the field are rows of the image
     QPainter painter(&m_pixmap);
-    for(int i = 0; i  < size; i++)
+    for(int i = 0; i  < fieldHeight(); i++)
     {
-        for(int j = 0; j < size; j++)
+        for(int j = 0; j < fieldWidth(); j++)
         {
-            double val = 1.0f - (m_solver.u0[i][j] - m_solver.minu) / (m_solver.maxu - m_solver.minu);
+            double val = 1.0f - (value(i,j) - s->minu) / range;
 
             int r = 255 * clamp(colormapRed(val), 0.0, 1.0);
             int g = 255 * clamp(colormapGreen(val), 0.0, 1.0);
@@ -96,7 +168,7 @@ void RDWidget::draw()
 
             QColor color = QColor(r, g , b);
             painter.setPen(color);
-            painter.drawPoint(i, j);
+            painter.drawPoint(j, i);
         }
     }
 
@@ -148,6 +220,33 @@ float RDWidget::clamp(float x, float min, float max)
     return qMax(qMin(x, max), min);
 }
 
+int RDWidget::fieldWidth() const
+{
+#ifdef HAVE_MPI
+    if(m_distributed)
+        return m_field.cols;
+#endif
+    return m_solver.width;
+}
+
+int RDWidget::fieldHeight() const
+{
+#ifdef HAVE_MPI
+    if(m_distributed)
+        return m_field.rows;
+#endif
+    return m_solver.height;
+}
+
+double RDWidget::value(int i, int j) const
+{
+#ifdef HAVE_MPI
+    if(m_distributed)
+        return m_field(i,j);
+#endif
+    return m_solver.value(i,j);
+}
+
 QPixmap RDWidget::pixmap() const
 {
     return m_pixmap;
@@ -155,10 +254,28 @@ QPixmap RDWidget::pixmap() const
 
 Surface RDWidget::surface()
 {
-    Matrix<float> mat(m_solver.size, m_solver.size);
-    for(int i = 0; i < m_solver.size; i++)
-        for(int j = 0; j < m_solver.size; j++)
-            mat(i,j) = 1.0f - (m_solver.u0[i][j] - m_solver.minu) / (m_solver.maxu - m_solver.minu);
+    if(solver()->dimensions() == 3)
+    {
+        int n = m_solver.width;
+        double range = m_solver.maxu > m_solver.minu ? m_solver.maxu - m_solver.minu : 1;
+
+        // every step-th cell keeps the mesh of large volumes small enough
+        int step = qMax(1, n / 128);
+        int m = (n - 1) / step + 1;
+        std::vector<float> volume(m * m * m);
+        for(int k = 0; k < m; k++)
+            for(int i = 0; i < m; i++)
+                for(int j = 0; j < m; j++)
+                    volume[(k * m + i) * m + j] = (m_solver.value(i * step, j * step, k * step) - m_solver.minu) / range;
+
+        return Surface(volume, m, 0.5f);
+    }
+
+    const Solver *s = solver();
+    Matrix<float> mat(fieldHeight(), fieldWidth());
+    for(int i = 0; i < fieldHeight(); i++)
+        for(int j = 0; j < fieldWidth(); j++)
+            mat(i,j) = 1.0f - (value(i,j) - s->minu) / (s->maxu - s->minu);
 
     Surface surf(mat);
     return surf;
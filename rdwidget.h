@@ -5,27 +5,48 @@
 #include "solver.h"
 #include "surface.h"
 
+#ifdef HAVE_MPI
+#include "distributedsolver.h"
+#endif
+
 class RDWidget : public GLWidget
 {
+    Q_OBJECT
 public:
     explicit RDWidget(QWidget *parent = 0);
     ~RDWidget();
 
+    // solver of the whole field, or of the block of rank 0 when the run
+    // is split over MPI ranks
     Solver *solver();
 
     QPixmap pixmap() const;
+    // height map of the field, or isosurface of a volume at the middle of
+    // the color range
     Surface surface();
 
 public slots:
-    void init(int size, double dt);
-    void setSize(int size);
+    void init(int width, int height, double dt);
+    void setSize(int width, int height);
     void setTimeStep(double dt);
     void setFramesToSkip(uint frames);
+    void setThreadCount(int threads);
+    // ends the run once the solver reports a steady state, otherwise it
+    // is only signalled
+    void setStopWhenSteady(bool stop);
+    // plane of a volume that is drawn
+    void setSlice(int slice);
 
     void start();
     void stop();
     void save();
 
+signals:
+    // emitted after every batch of steps
+    void advanced();
+    // emitted when the state becomes steady
+    void steady();
+
 private slots:
     void render();
     void draw();
@@ -40,13 +61,24 @@ private:
     float colormapGreen(float x);
     float colormapBlue(float x);
     float clamp(float x, float min, float max);
+    // cells of the field that is drawn and the value of u at cell (i, j)
+    int fieldWidth() const;
+    int fieldHeight() const;
+    double value(int i, int j) const;
 
     Solver m_solver;
+#ifdef HAVE_MPI
+    // run split over the ranks of an MPI launch, 0 with a single rank
+    DistributedSolver *m_distributed;
+    // u gathered from the blocks for drawing
+    Matrix<double> m_field;
+#endif
     QPixmap m_pixmap;
     bool isActive;
 
-    uint frame;
     uint m_framesToSkip;
+    bool m_stopWhenSteady;
+    bool m_steady;
 };
 
 #endif // RDWIDGET_H
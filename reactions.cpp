@@ -0,0 +1,84 @@
+#include "reactions.h"
+
+#include <cstring>
+
+using namespace std;
+
+struct KnownReaction
+{
+    ReactionKind kind;
+    const char *fu;
+    const char *fv;
+    const char *params[3];
+};
+
+static const KnownReaction known[] = {
+    {ReactionGrayScott, "-x*y^2+b-b*x", "x*y^2-d*y", {"b", "d", nullptr}},
+    {ReactionFitzHughNagumo, "lambda*(x-x^3-y)", "b*(x-d*y)", {"lambda", "b", "d"}}
+};
+
+static bool sameTree(const te_expr *a, const te_expr *b)
+{
+    if(a->type != b->type)
+        return false;
+
+    int type = a->type & 0x1F;
+    if(type == TE_CONSTANT)
+        return a->value == b->value;
+    if(type == TE_VARIABLE)
+        return a->bound == b->bound;
+
+    if(a->function != b->function)
+        return false;
+
+    int arity = type & 0x7;
+    for(int k = 0; k < arity; k++)
+        if(!sameTree((const te_expr*)a->parameters[k], (const te_expr*)b->parameters[k]))
+            return false;
+
+    return true;
+}
+
+ReactionKind detectReaction(const te_expr *fu, const te_expr *fv,
+                            const te_variable *vars, int count,
+                            vector<const double*> &params)
+{
+    params.clear();
+    if(!fu || !fv)
+        return ReactionExpression;
+
+    for(const KnownReaction &reaction : known)
+    {
+        int err;
+        te_expr *ku = te_compile(reaction.fu, vars, count, &err);
+        te_expr *kv = te_compile(reaction.fv, vars, count, &err);
+
+        bool match = ku && kv && sameTree(fu, ku) && sameTree(fv, kv);
+        te_free(ku);
+        te_free(kv);
+
+        if(!match)
+            continue;
+
+        for(const char *name : reaction.params)
+        {
+            for(int k = 0; name && k < count; k++)
+                if(strcmp(vars[k].name, name) == 0)
+                    params.push_back((const double*)vars[k].address);
+        }
+
+        return reaction.kind;
+    }
+
+    return ReactionExpression;
+}
+
+const char *reactionName(ReactionKind kind)
+{
+    switch(kind)
+    {
+    case ReactionGrayScott: return "Gray-Scott";
+    case ReactionFitzHughNagumo: return "FitzHugh-Nagumo";
+    default: return "expression";
+    }
+}
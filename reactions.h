@@ -0,0 +1,101 @@
+#ifndef REACTIONS_H
+#define REACTIONS_H
+
+#include <string>
+#include <vector>
+
+#include "tinyexpr.h"
+
+// Hand written kernels for the stock models. Each reaction evaluates its
+// terms in the same order as the interpreter does for the expressions it
+// replaces, so switching kernel does not change the results.
+
+enum ReactionKind
+{
+    ReactionExpression,
+    ReactionGrayScott,
+    ReactionFitzHughNagumo
+};
+
+// fu = -x*y^2+b-b*x, fv = x*y^2-d*y
+template<class T>
+struct GrayScott
+{
+    T b, d;
+
+    T fu(T x, T y) const { return -x * (y * y) + b - b * x; }
+    T fv(T x, T y) const { return x * (y * y) - d * y; }
+};
+
+// fu = lambda*(x-x^3-y), fv = b*(x-d*y)
+template<class T>
+struct FitzHughNagumo
+{
+    T lambda, b, d;
+
+    T fu(T x, T y) const { return lambda * (x - x * x * x - y); }
+    T fv(T x, T y) const { return b * (x - d * y); }
+};
+
+// Explicit Euler step of one interior row with the 9-point laplacian. The
+// output rows never overlap the input ones, which lets the compiler
+// vectorize the loop
+template<class Reaction, class T>
+inline void reactionRow(const Reaction &r,
+                        const T *__restrict uu, const T *__restrict um, const T *__restrict ud,
+                        const T *__restrict vu, const T *__restrict vm, const T *__restrict vd,
+                        T *__restrict uo, T *__restrict vo, int n, T cu, T cv, T dt)
+{
+    for(int j = 1; j < n - 1; j++)
+    {
+        T x = um[j], y = vm[j];
+        T lu = uu[j] + ud[j] + um[j-1] + um[j+1] + uu[j-1] + ud[j+1] + uu[j+1] + ud[j-1] - 8 * um[j];
+        T lv = vu[j] + vd[j] + vm[j-1] + vm[j+1] + vu[j-1] + vd[j+1] + vu[j+1] + vd[j-1] - 8 * vm[j];
+        uo[j] = um[j] + dt * (cu * lu + r.fu(x, y));
+        vo[j] = vm[j] + dt * (cv * lv + r.fv(x, y));
+    }
+}
+
+// Explicit Euler step of rows [begin, end)
+template<class Reaction, class T>
+void reactionStep(const Reaction &r, const T *u0, const T *v0, T *u, T *v,
+                  int begin, int end, int n, int stride, T cu, T cv, T dt)
+{
+    for(int i = begin; i < end; i++)
+    {
+        const T *um = u0 + (long)i * stride, *vm = v0 + (long)i * stride;
+        reactionRow(r, um - stride, um, um + stride, vm - stride, vm, vm + stride,
+                    u + (long)i * stride, v + (long)i * stride, n, cu, cv, dt);
+    }
+}
+
+// Reaction terms alone of rows [begin, end), for the integrators that
+// treat diffusion separately
+template<class Reaction, class T>
+void reactionTerms(const Reaction &r, const T *u0, const T *v0, T *ru, T *rv,
+                   int begin, int end, int n, int stride)
+{
+    for(int i = begin; i < end; i++)
+    {
+        const T *um = u0 + (long)i * stride, *vm = v0 + (long)i * stride;
+        T *uo = ru + (long)i * stride, *vo = rv + (long)i * stride;
+
+        for(int j = 1; j < n - 1; j++)
+        {
+            uo[j] = r.fu(um[j], vm[j]);
+            vo[j] = r.fv(um[j], vm[j]);
+        }
+    }
+}
+
+// Recognizes the stock models by comparing the compiled trees of fu and fv
+// with the known forms, compiled with the same variables. On a match,
+// params receives the addresses of the parameters in the order of the
+// reaction struct members
+ReactionKind detectReaction(const te_expr *fu, const te_expr *fv,
+                            const te_variable *vars, int count,
+                            std::vector<const double*> &params);
+
+const char *reactionName(ReactionKind kind);
+
+#endif // REACTIONS_H
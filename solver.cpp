@@ -1,191 +1,2458 @@
 #include "solver.h"
+#include "exprderivative.h"
 
 #include <cmath>
 #include <limits>
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
 
 Solver::Solver() :
-    size(0), dt(1.0f), fu_expr(0), fv_expr(0)
+    width(0), height(0), dt(1.0f), maxu(1), maxv(1), minu(0), minv(0), fu_expr(0), fv_expr(0), m_reaction(ReactionExpression), m_native(false),
+    m_dimensions(2), m_block(0), m_slice(-1), m_precision(PrecisionDouble), m_integrator(IntegratorExplicit), m_tolerance(1e-3), m_time(0), m_stepSize(1.0f), m_timeStep(1.0f), m_autoTimeStep(0),
+    m_splitDiffusion(SplitDiffusionCrankNicolson), m_diffusionSteps(1), m_splitReaction(SplitReactionRK4), m_reactionSteps(1),
+    m_activeTolerance(0), m_activeRows(0), m_activeColumns(0), m_activeCount(0),
+    m_boundary(BoundaryNeumann), m_boundaryU(1), m_boundaryV(0),
+    m_normalization(NormalizationFrame), m_window(30), m_percentile(1),
+    m_rateMax(numeric_limits<double>::infinity()), m_rateL2(numeric_limits<double>::infinity()),
+    m_steadyTolerance(0), m_steadyNorm(RateNormMax)
 {
+    setSimdLevel(detectSimdLevel());
+}
+
+Solver::~Solver()
+{
+    freeExpr();
+}
+
+void Solver::setModel(Model model)
+{
+    m_model = model;
+    compileParams();
+}
+
+void Solver::setModel(Model model, const Solver &compiled)
+{
+    m_model = model;
+    compileParams(compiled.isCompiled() && sameExpressions(model, compiled.m_model) ? &compiled : 0);
+}
+
+const Model &Solver::model() const
+{
+    return m_model;
+}
+
+// dispatch to the fields of the active precision
+#define WITH_FIELDS(call) \
+    (m_precision == PrecisionFloat ? call(m_float) : call(m_double))
+
+// working set of one tile of rows in tiledSteps(), meant to stay in L2
+static const int TILE_BYTES = 512 * 1024;
+
+// bounds of the change of dt after one adaptive step, and the fraction
+// of the optimal dt aimed at so that the next step is likely accepted
+static const double DT_SHRINK = 0.2;
+static const double DT_GROW = 5.0;
+static const double DT_SAFETY = 0.9;
+// smallest adaptive dt as a fraction of the dt given to setTimeStep(),
+// a step of that size is accepted whatever its error
+static const double DT_MIN = 1e-12;
+
+// cells sampled along the longer side for the reaction jacobian
+static const int JACOBIAN_SAMPLES = 64;
+
+// largest number of cells sampled for the percentiles of the color range
+static const int PERCENTILE_SAMPLES = 65536;
+
+// rows advanced through all the reaction substeps of a split step at once
+static const int REACTION_CHUNK = 8;
+
+// cells per side of the tiles skipped by the active mode
+static const int ACTIVE_TILE = 32;
+
+// ROS2 diagonal coefficient 1 + 1 / sqrt(2), makes the method L-stable
+static const double ROS2_GAMMA = 1.7071067811865475;
+
+// larger of a and b, NaN when either is, so that the change of a run
+// that diverged is not taken for no change
+template<class T>
+static inline T maxChange(T a, T b)
+{
+    return a > b || a != a ? a : b;
+}
+
+// entry (s, t) of m in fractional rows and columns, linear between the
+// four nearest entries
+static double interpolate(const Matrix<double> &m, double s, double t)
+{
+    int i = min((int)s, max(0, m.rows - 2)), j = min((int)t, max(0, m.cols - 2));
+    int i1 = min(i + 1, m.rows - 1), j1 = min(j + 1, m.cols - 1);
+    double a = s - i, b = t - j;
+    return (1 - a) * ((1 - b) * m(i,j) + b * m(i,j1)) + a * ((1 - b) * m(i1,j) + b * m(i1,j1));
+}
+
+void Solver::solve(int steps)
+{
+    if(!isCompiled() || steps < 1 || (m_dimensions == 3 && speciesCount() > 2))
+        return;
+    if(m_block && speciesCount() > 2)
+        return;
+
+    if(m_precision == PrecisionFloat)
+        solveSteps(m_float, steps);
+    else
+        solveSteps(m_double, steps);
+}
+
+template<class T>
+void Solver::solveSteps(Fields<T> &f, int steps)
+{
+    Integrator integrator = stepIntegrator();
+    updateDiffusion();
+
+    // without a bound the dt given to setTimeStep() is kept
+    if(m_autoTimeStep > 0 && integrator != IntegratorAdaptive)
+    {
+        double limit = stableTimeStep();
+        dt = isfinite(limit) ? m_autoTimeStep * limit : m_timeStep;
+    }
+
+    for(size_t k = 0; k < m_paramAddresses.size(); k++)
+        m_paramValues[k] = *m_paramAddresses[k];
+
+    // per thread scratch rows of the interpreter
+    f.ru.resize(m_pool.size());
+    f.rv.resize(m_pool.size());
+    f.stack.resize(m_pool.size());
+    f.rw.resize(m_pool.size());
+    f.inputs.resize(m_pool.size());
+
+    // the adaptive integrator accounts for its own steps
+    if(integrator != IntegratorAdaptive)
+    {
+        m_time += steps * dt;
+        m_stepSize = dt;
+    }
+
+    m_rowSquares.assign(f.u0.rows, 0);
+    m_rowChange.assign(f.u0.rows, 0);
+
+    if(m_block)
+    {
+        for(; steps > 0; steps--)
+            blockStep(f, steps == 1);
+        reduceRate(dt);
+    }
+    else if(m_dimensions == 3)
+    {
+        for(; steps > 0; steps--)
+            volumeStep(f, steps == 1);
+        reduceRate(dt);
+    }
+    else if(speciesCount() > 2)
+    {
+        speciesBuffers(f);
+        for(; steps > 0; steps--)
+            speciesStep(f, steps == 1);
+        reduceRate(dt);
+    }
+    else if(integrator != IntegratorExplicit)
+    {
+        for(; steps > 0; steps--)
+        {
+            // these integrators overwrite or reuse the previous state, the
+            // one before the last step is kept to measure the rate
+            double start = m_time;
+            if(steps == 1)
+            {
+                if(f.pu.rows != height || f.pu.cols != width)
+                {
+                    f.pu = Matrix<T>(height, width);
+                    f.pv = Matrix<T>(height, width);
+                }
+                copy(f.u0.data(), f.u0.data() + height * f.u0.stride, f.pu.data());
+                copy(f.v0.data(), f.v0.data() + height * f.v0.stride, f.pv.data());
+            }
+
+            if(integrator == IntegratorADI)
+                adiStep(f);
+            else if(integrator == IntegratorETD)
+                etdStep(f);
+            else if(integrator == IntegratorImplicit)
+                implicitStep(f);
+            else if(integrator == IntegratorAdaptive)
+                adaptiveStep(f);
+            else
+                splitStep(f);
+
+            if(steps == 1)
+            {
+                measureRate(f, f.pu, f.pv);
+                reduceRate(integrator == IntegratorAdaptive ? m_time - start : dt);
+            }
+        }
+    }
+    else if(m_activeTolerance > 0)
+    {
+        for(; steps > 0; steps--)
+            activeStep(f);
+
+        // the other buffers hold the previous state of every cell
+        measureRate(f, f.u, f.v);
+        reduceRate(dt);
+    }
+    else
+    {
+        // tiles of rows whose working set stays in cache. The depth of a
+        // trapezoid is limited by the height of its tile
+        int rows = height - 2;
+        int tileRows = max<int>(8, TILE_BYTES / (4 * sizeof(T) * f.u0.stride));
+        tileRows = min(tileRows, max(1, rows / m_pool.size()));
+        int tiles = max(1, rows / tileRows);
+        int depth = max(1, tileRows / 2);
+        // periodic ghost rows come from the far end of the field, which
+        // another tile only computes later
+        if(haloCondition() == BoundaryPeriodic)
+            depth = 1;
+
+        while(steps > 0)
+        {
+            int count = min(steps, depth);
+            if(count == 1)
+                step(f, count == steps);
+            else
+                tiledSteps(f, tiles, count, count == steps);
+            steps -= count;
+        }
+        reduceRate(dt);
+    }
+
+    // only active steps keep track of the changes
+    if(m_block || m_dimensions == 3 || speciesCount() > 2 || integrator != IntegratorExplicit ||
+       m_activeTolerance <= 0)
+        wakeTiles();
+}
+
+template<class T>
+void Solver::step(Fields<T> &f, bool measure)
+{
+    // interior rows are split in contiguous bands, one per thread. Every
+    // cell only depends on the previous state, so the result does not
+    // depend on the number of bands
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+    m_pool.run(bands, [this, &f, rows, bands, measure](int band, int thread) {
+        int begin = 1 + band * rows / bands, end = 1 + (band + 1) * rows / bands;
+        levelRows(f, thread, f.u0, f.v0, f.u, f.v, begin, end, measure);
+    });
+
+    // the new state becomes the current one, the old buffers are reused
+    // as the target of the next step
+    f.u0.swap(f.u); f.v0.swap(f.v);
+}
+
+// Advances count steps with trapezoidal temporal blocking. Level s of the
+// solution lives in (u0, v0) when s is even and in (u, v) when it is odd.
+// The interior rows are cut in tiles, and every tile first computes an
+// upright trapezoid: level s covers the tile minus s - 1 rows on each side
+// shared with another tile, so it only reads levels of the same tile. The
+// gaps left between two tiles are then filled by inverted trapezoids that
+// grow by one row per level on each side.
+// Every row of every level is computed exactly once from the same inputs
+// as in step(), so the results are identical. A row of level s overwrites
+// level s - 2, which by then no longer has readers in either phase
+template<class T>
+void Solver::tiledSteps(Fields<T> &f, int tiles, int count, bool measure)
+{
+    int rows = height - 2;
+    Matrix<T> *us[] = {&f.u0, &f.u}, *vs[] = {&f.v0, &f.v};
+
+    // row range of level s for the upright trapezoid of a tile
+    auto upright = [this, rows, tiles, us, vs, &f, count, measure](int tile, int thread) {
+        int begin = 1 + tile * rows / tiles, end = 1 + (tile + 1) * rows / tiles;
+        for(int s = 1; s <= count; s++)
+        {
+            int b = tile == 0 ? begin : begin + s - 1;
+            int e = tile == tiles - 1 ? end : end - s + 1;
+            if(b < e)
+                levelRows(f, thread, *us[(s-1)%2], *vs[(s-1)%2], *us[s%2], *vs[s%2], b, e, measure && s == count);
+        }
+    };
+
+    // rows of level s around the edge between tile and tile + 1
+    auto inverted = [this, rows, tiles, us, vs, &f, count, measure](int tile, int thread) {
+        int edge = 1 + (tile + 1) * rows / tiles;
+        for(int s = 2; s <= count; s++)
+            levelRows(f, thread, *us[(s-1)%2], *vs[(s-1)%2], *us[s%2], *vs[s%2], edge - s + 1, edge + s - 1,
+                      measure && s == count);
+    };
+
+    m_pool.run(tiles, upright);
+    m_pool.run(tiles - 1, inverted);
+
+    if(count % 2)
+    {
+        f.u0.swap(f.u); f.v0.swap(f.v);
+    }
+}
+
+// Explicit step of a volume with the 7-point laplacian. The interior
+// planes are cut in slabs, one per thread
+template<class T>
+void Solver::volumeStep(Fields<T> &f, bool measure)
+{
+    int planes = width - 2;
+    int slabs = min(m_pool.size(), planes);
+    m_pool.run(slabs, [this, &f, planes, slabs, measure](int slab, int thread) {
+        volumeRows(f, thread, 1 + slab * planes / slabs, 1 + (slab + 1) * planes / slabs, measure);
+    });
+
+    setVolumeBoundary(f.u, f.v);
+    f.u0.swap(f.u); f.v0.swap(f.v);
+}
+
+// Updates the planes [begin, end). Whole planes do not fit in cache at
+// the sizes volumes are run at, so the slab is swept in tiles of rows: a
+// tile goes through every plane of the slab, and the rows it reads from
+// the plane below and the current one are still cached from the tile
+// rows of the previous planes
+template<class T>
+void Solver::volumeRows(Fields<T> &f, int thread, int begin, int end, bool measure)
+{
+    FlushDenormals flush(sizeof(T) == sizeof(float));
+
+    double h = spacing();
+    T cu = du / (h * h), cv = dv / (h * h);
+
+    // three planes of the tile rows of u and v
+    int tileRows = max(1, TILE_BYTES / (6 * (int)sizeof(T) * f.u0.stride));
+
+    int n = width;
+    vector<T> &ru = f.ru[thread], &rv = f.rv[thread];
+    ru.resize(n);
+    rv.resize(n);
+
+    int plane = n * f.u0.stride;
+    for(int top = 1; top < n - 1; top += tileRows)
+    {
+        int bottom = min(n - 1, top + tileRows);
+        for(int p = begin; p < end; p++)
+            for(int i = top; i < bottom; i++)
+            {
+                int r = p * n + i;
+                const T *u0 = f.u0.row(r), *v0 = f.v0.row(r);
+                rowTerms(f, thread, u0, v0, ru.data(), rv.data(), i);
+
+                f.kernels.volumeRow(f.u0.row(r - 1), u0, f.u0.row(r + 1), u0 - plane, u0 + plane,
+                                    ru.data(), f.u.row(r), n, cu, (T)dt);
+                f.kernels.volumeRow(f.v0.row(r - 1), v0, f.v0.row(r + 1), v0 - plane, v0 + plane,
+                                    rv.data(), f.v.row(r), n, cv, (T)dt);
+
+                if(measure)
+                    rateRows(f.u0, f.v0, f.u, f.v, r, r + 1);
+            }
+    }
+}
+
+// reaction terms of the interior cells of one row, row i of the planes
+template<class T>
+void Solver::rowTerms(Fields<T> &f, int thread, const T *u, const T *v, T *ru, T *rv, int row)
+{
+    const vector<const double*> &p = m_reactionParams;
+
+    switch(m_reaction)
+    {
+    case ReactionGrayScott:
+    {
+        GrayScott<T> r = {(T)*p[0], (T)*p[1]};
+        ::reactionTerms(r, u, v, ru, rv, 0, 1, width, 0);
+        return;
+    }
+    case ReactionFitzHughNagumo:
+    {
+        FitzHughNagumo<T> r = {(T)*p[0], (T)*p[1], (T)*p[2]};
+        ::reactionTerms(r, u, v, ru, rv, 0, 1, width, 0);
+        return;
+    }
+    default:
+        break;
+    }
+
+    if(m_jit.isLoaded())
+        m_jit.react(u, v, ru, rv, 0, 1, width, 0, m_paramValues.data(),
+                    (const void *const*)(fieldInputs(f, thread, row, 0) + 2));
+    else
+        reactions(f, thread, u, v, ru, rv, width, row, 0);
+}
+
+// Explicit step of every species of a model with more than two
+template<class T>
+void Solver::speciesStep(Fields<T> &f, bool measure)
+{
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+    m_pool.run(bands, [this, &f, rows, bands, measure](int band, int thread) {
+        speciesRows(f, thread, 1 + band * rows / bands, 1 + (band + 1) * rows / bands, measure);
+    });
+
+    f.u0.swap(f.u); f.v0.swap(f.v);
+    for(size_t k = 0; k < f.w0.size(); k++)
+        f.w0[k].swap(f.w[k]);
+}
+
+// One sweep over the rows [begin, end) that updates all the species: the
+// reaction terms of a row are evaluated for every species from the
+// current state, then each species takes the explicit step of its own
+// array and gets its halo. With measure set the change of the row is
+// taken as well
+template<class T>
+void Solver::speciesRows(Fields<T> &f, int thread, int begin, int end, bool measure)
+{
+    FlushDenormals flush(sizeof(T) == sizeof(float));
+
+    int count = speciesCount();
+    double h = spacing();
+    double invh = 1.0f / (3 * h * h);
+
+    vector<const Matrix<T>*> from = {&f.u0, &f.v0};
+    vector<Matrix<T>*> to = {&f.u, &f.v};
+    vector<T> halo = {(T)m_boundaryU, (T)m_boundaryV};
+    for(size_t k = 0; k < f.w0.size(); k++)
+    {
+        from.push_back(&f.w0[k]);
+        to.push_back(&f.w[k]);
+        halo.push_back(0);
+    }
+    vector<const ExprProgram*> programs = speciesPrograms();
+
+    // the parameter fields come after the species
+    vector<T> &r = f.rw[thread];
+    r.resize(count * width);
+    vector<const T*> inputs(count + f.params.size());
+
+    for(int i = begin; i < end; i++)
+    {
+        for(int k = 0; k < count; k++)
+            inputs[k] = from[k]->row(i) + 1;
+        for(size_t k = 0; k < f.params.size(); k++)
+            inputs[count + k] = f.params[k].row(i) + 1;
+        for(int k = 0; k < count; k++)
+            programs[k]->eval(inputs.data(), r.data() + k * width + 1, width - 2, f.stack[thread]);
+
+        for(int k = 0; k < count; k++)
+        {
+            const Matrix<T> &w0 = *from[k];
+            f.kernels.updateRow(w0.row(i-1), w0.row(i), w0.row(i+1), r.data() + k * width, to[k]->row(i),
+                                width, (T)(invh * m_diffusion[k]), (T)dt);
+            haloRows(*to[k], halo[k], i, i + 1);
+        }
+
+        if(!measure)
+            continue;
+
+        rateRows(f.u0, f.v0, f.u, f.v, i, i + 1);
+        for(int k = 2; k < count; k++)
+        {
+            const T *w0 = from[k]->row(i), *w = to[k]->row(i);
+            T squares = 0, change = 0;
+            for(int j = 1; j < width - 1; j++)
+            {
+                T a = w[j] - w0[j];
+                squares += a * a;
+                change = maxChange(change, (T)fabs(a));
+            }
+            m_rowSquares[i] += squares;
+            m_rowChange[i] = maxChange(m_rowChange[i], (double)change);
+        }
+    }
+}
+
+// Explicit step of the tiles that changed in the last step and of their
+// neighbours. A change spreads by one cell per step, less than a tile, so
+// the tiles left out would not have changed by more than the tolerance.
+// They keep their values, which are copied once to the other buffer after
+// the tile went quiet
+template<class T>
+void Solver::activeStep(Fields<T> &f)
+{
+    int tileRows = (height - 2 + ACTIVE_TILE - 1) / ACTIVE_TILE;
+    int tileColumns = (width - 2 + ACTIVE_TILE - 1) / ACTIVE_TILE;
+    int tiles = tileRows * tileColumns;
+
+    // other parameters give other dynamics, every tile is woken up
+    vector<double> state(m_paramValues);
+    state.push_back(dt);
+    state.push_back(du);
+    state.push_back(dv);
+    if(state != m_activeState)
+        wakeTiles();
+
+    if(m_activeRows != tileRows || m_activeColumns != tileColumns)
+    {
+        m_activeRows = tileRows;
+        m_activeColumns = tileColumns;
+        m_activeState = state;
+        m_changed.assign(tiles, 1);
+        m_synced.assign(tiles, 0);
+    }
+
+    // on a periodic field the tiles of opposite edges are neighbours
+    bool wrap = haloCondition() == BoundaryPeriodic;
+    vector<char> update(tiles, 0);
+    for(int ti = 0; ti < tileRows; ti++)
+        for(int tj = 0; tj < tileColumns; tj++)
+            if(m_changed[ti * tileColumns + tj])
+                for(int di = -1; di <= 1; di++)
+                    for(int dj = -1; dj <= 1; dj++)
+                    {
+                        int i = ti + di, j = tj + dj;
+                        if(wrap)
+                        {
+                            i = (i + tileRows) % tileRows;
+                            j = (j + tileColumns) % tileColumns;
+                        }
+                        if(i >= 0 && i < tileRows && j >= 0 && j < tileColumns)
+                            update[i * tileColumns + j] = 1;
+                    }
+
+    m_activeCount = count(update.begin(), update.end(), 1);
+
+    T rate = m_activeTolerance * dt;
+    m_pool.run(tiles, [this, &f, &update, tileColumns, rate](int tile, int thread) {
+        int top = 1 + tile / tileColumns * ACTIVE_TILE, bottom = min(height - 1, top + ACTIVE_TILE);
+        int left = 1 + tile % tileColumns * ACTIVE_TILE, right = min(width - 1, left + ACTIVE_TILE);
+
+        if(!update[tile])
+        {
+            if(!m_synced[tile])
+                for(int i = top; i < bottom; i++)
+                {
+                    copy(f.u0.row(i) + left, f.u0.row(i) + right, f.u.row(i) + left);
+                    copy(f.v0.row(i) + left, f.v0.row(i) + right, f.v.row(i) + left);
+                }
+            m_changed[tile] = 0;
+            m_synced[tile] = 1;
+            return;
+        }
+
+        solveBlock(f, thread, f.u0, f.v0, f.u, f.v, top, bottom, left, right);
+
+        T change = 0;
+        for(int i = top; i < bottom; i++)
+        {
+            const T *u0 = f.u0.row(i), *v0 = f.v0.row(i), *u = f.u.row(i), *v = f.v.row(i);
+            for(int j = left; j < right; j++)
+                change = maxChange(change, maxChange((T)fabs(u[j] - u0[j]), (T)fabs(v[j] - v0[j])));
+        }
+
+        // a tile with cells that diverged is never quiet
+        m_changed[tile] = change > rate || !isfinite(change);
+        m_synced[tile] = 0;
+    });
+
+    setBoundary(f.u, f.v);
+    f.u0.swap(f.u); f.v0.swap(f.v);
+}
+
+// Explicit step of a block of a larger field. The ghost columns are
+// exchanged while the cells that do not read any ghost cell are computed,
+// then the ghost rows, which carry the corners, while the first and last
+// columns of the rows in between are. The first and last rows go last.
+// The halo ends up as the one setBoundary() gives the whole field, so the
+// cells are the same as in a single solver
+template<class T>
+void Solver::blockStep(Fields<T> &f, bool measure)
+{
+    int m = height, n = width;
+
+    m_block->start(f.u0, f.v0, false);
+    if(m > 4 && n > 4)
+    {
+        int rows = m - 4;
+        int bands = min(m_pool.size(), rows);
+        m_pool.run(bands, [this, &f, rows, bands, n](int band, int thread) {
+            solveBlock(f, thread, f.u0, f.v0, f.u, f.v, 2 + band * rows / bands, 2 + (band + 1) * rows / bands, 2, n - 2);
+        });
+    }
+    m_block->finish(f.u0, f.v0);
+
+    // ghost rows on the edges of the field take the fresh ghost columns
+    // as their corners
+    blockHalo(f.u0, (T)m_boundaryU, true);
+    blockHalo(f.v0, (T)m_boundaryV, true);
+
+    m_block->start(f.u0, f.v0, true);
+    if(m > 4)
+    {
+        solveBlock(f, 0, f.u0, f.v0, f.u, f.v, 2, m - 2, 1, 2);
+        if(n > 3)
+            solveBlock(f, 0, f.u0, f.v0, f.u, f.v, 2, m - 2, n - 2, n - 1);
+    }
+    m_block->finish(f.u0, f.v0);
+
+    solveBlock(f, 0, f.u0, f.v0, f.u, f.v, 1, 2, 1, n - 1);
+    if(m > 3)
+        solveBlock(f, 0, f.u0, f.v0, f.u, f.v, m - 2, m - 1, 1, n - 1);
+
+    blockHalo(f.u, (T)m_boundaryU, false);
+    blockHalo(f.v, (T)m_boundaryV, false);
+    if(measure)
+        rateRows(f.u0, f.v0, f.u, f.v, 1, m - 1);
+
+    f.u0.swap(f.u); f.v0.swap(f.v);
+}
+
+// halo of a block on the edges of the whole field: the ghost columns of
+// the interior rows, or the whole ghost rows. Periodic edges are always
+// shared
+template<class T>
+void Solver::blockHalo(Matrix<T> &w, T value, bool rows)
+{
+    int m = height, n = width;
+    bool dirichlet = haloCondition() == BoundaryDirichlet;
+
+    if(rows)
+    {
+        if(!m_block->isShared(Block::EdgeTop))
+        {
+            if(dirichlet)
+                fill(w.row(0), w.row(0) + n, value);
+            else
+                copy(w.row(1), w.row(1) + n, w.row(0));
+        }
+        if(!m_block->isShared(Block::EdgeBottom))
+        {
+            if(dirichlet)
+                fill(w.row(m - 1), w.row(m - 1) + n, value);
+            else
+                copy(w.row(m - 2), w.row(m - 2) + n, w.row(m - 1));
+        }
+        return;
+    }
+
+    bool left = !m_block->isShared(Block::EdgeLeft), right = !m_block->isShared(Block::EdgeRight);
+    for(int i = 1; i < m - 1; i++)
+    {
+        if(left)
+            w(i,0) = dirichlet ? value : w(i,1);
+        if(right)
+            w(i,n - 1) = dirichlet ? value : w(i,n - 2);
+    }
+}
+
+// out[j] = w + a * (second difference of w along the column) + half * r
+template<class T>
+static void explicitColumn(const Matrix<T> &w, const Matrix<T> &r, T *out, int i, T a, T half, int begin, int end)
+{
+    const T *up = w.row(i-1), *mid = w.row(i), *down = w.row(i+1), *ri = r.row(i);
+    for(int j = begin; j < end; j++)
+        out[j] = mid[j] + a * (up[j] - 2 * mid[j] + down[j]) + half * ri[j];
+}
+
+// out[j] = w + a * (second difference of w along the row) + half * r
+template<class T>
+static void explicitRow(const Matrix<T> &w, const Matrix<T> &r, T *out, int i, T a, T half, int begin, int end)
+{
+    const T *mid = w.row(i), *ri = r.row(i);
+    for(int j = begin; j < end; j++)
+        out[j] = mid[j] + a * (mid[j-1] - 2 * mid[j] + mid[j+1]) + half * ri[j];
+}
+
+// Peaceman-Rachford step, with the reaction terms R taken at the start of
+// the step and a = D dt / (2 h^2):
+//   (1 - a dxx) w* = (1 + a dyy) w + dt/2 R      lines along the rows
+//   (1 - a dyy) w' = (1 + a dxx) w* + dt/2 R     lines along the columns
+// The diffusion part is unconditionally stable, only the reaction terms
+// limit dt. The intermediate w* goes to (u, v) and the result replaces
+// (u0, v0)
+template<class T>
+void Solver::adiStep(Fields<T> &f)
+{
+    double h = spacing();
+    T au = du * dt / (2 * h * h), av = dv * dt / (2 * h * h);
+    T half = dt / 2;
+
+    f.lineU.factor(width, au);
+    f.lineV.factor(width, av);
+    f.columnU.factor(height, au);
+    f.columnV.factor(height, av);
+    reactionBuffers(f);
+
+    // first half step, every line along a row is independent
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+    m_pool.run(bands, [this, &f, rows, bands, au, av, half](int band, int thread) {
+        FlushDenormals flush(sizeof(T) == sizeof(float));
+
+        int begin = 1 + band * rows / bands, end = 1 + (band + 1) * rows / bands;
+        reactionTerms(f, thread, f.u0, f.v0, begin, end);
+
+        for(int i = begin; i < end; i++)
+        {
+            explicitColumn(f.u0, f.fu, f.u.row(i), i, au, half, 1, width - 1);
+            f.lineU.solve(f.u.row(i), width);
+            explicitColumn(f.v0, f.fv, f.v.row(i), i, av, half, 1, width - 1);
+            f.lineV.solve(f.v.row(i), width);
+        }
+
+        setBoundaryRows(f.u, f.v, begin, end);
+    });
+
+    // second half step, the lines along the columns of a band are
+    // eliminated together one row at a time
+    int cols = width - 2;
+    bands = min(m_pool.size(), cols);
+    m_pool.run(bands, [this, &f, cols, bands, au, av, half](int band, int) {
+        FlushDenormals flush(sizeof(T) == sizeof(float));
+
+        int begin = 1 + band * cols / bands, end = 1 + (band + 1) * cols / bands;
+        for(int i = 1; i < height - 1; i++)
+        {
+            explicitRow(f.u, f.fu, f.u0.row(i), i, au, half, begin, end);
+            f.columnU.forward(f.u0.row(i), f.u0.row(i-1), i, begin, end);
+            explicitRow(f.v, f.fv, f.v0.row(i), i, av, half, begin, end);
+            f.columnV.forward(f.v0.row(i), f.v0.row(i-1), i, begin, end);
+        }
+        for(int i = height - 3; i >= 1; i--)
+        {
+            f.columnU.backward(f.u0.row(i), f.u0.row(i+1), i, begin, end);
+            f.columnV.backward(f.v0.row(i), f.v0.row(i+1), i, begin, end);
+        }
+    });
+
+    setBoundary(f.u0, f.v0);
+}
+
+// Exponential time differencing RK4 (Cox and Matthews). With L the
+// diffusion operator and N the reaction terms, in spectral space:
+//   a = E2 w + Q N(w)
+//   b = E2 w + Q N(a)
+//   c = E2 a + Q (2 N(b) - N(w))
+//   w' = E w + f1 N(w) + 2 f2 (N(a) + N(b)) + f3 N(c)
+// where E = exp(dt L), E2 = exp(dt L / 2) and Q, f1, f2, f3 are the phi
+// functions computed by EtdCoefficients. The stages are evaluated in
+// (u, v) and the result replaces (u0, v0)
+template<class T>
+void Solver::etdStep(Fields<T> &f)
+{
+    m_etd.prepare(width, height, dt, du, dv);
+    reactionBuffers(f);
+
+    Etd &e = m_etd;
+    Matrix<T> *w0[] = {&f.u0, &f.v0}, *w[] = {&f.u, &f.v};
+    const EtdCoefficients *c[] = {&e.u, &e.v};
+    size_t count = e.state[0].size();
+
+    for(int s = 0; s < 2; s++)
+        e.dct.forward(*w0[s], e.state[s].data(), m_pool);
+    etdReactions(f, f.u0, f.v0, e.n0);
+
+    for(int s = 0; s < 2; s++)
+    {
+        for(size_t k = 0; k < count; k++)
+            e.stage[s][k] = c[s]->e2[k] * e.state[s][k] + c[s]->q[k] * e.n0[s][k];
+        e.dct.inverse(e.stage[s].data(), *w[s], m_pool);
+    }
+    etdReactions(f, f.u, f.v, e.na);
+
+    for(int s = 0; s < 2; s++)
+    {
+        for(size_t k = 0; k < count; k++)
+            e.stage[s][k] = c[s]->e2[k] * e.state[s][k] + c[s]->q[k] * e.na[s][k];
+        e.dct.inverse(e.stage[s].data(), *w[s], m_pool);
+    }
+    etdReactions(f, f.u, f.v, e.nb);
+
+    for(int s = 0; s < 2; s++)
+    {
+        for(size_t k = 0; k < count; k++)
+        {
+            double a = c[s]->e2[k] * e.state[s][k] + c[s]->q[k] * e.n0[s][k];
+            e.stage[s][k] = c[s]->e2[k] * a + c[s]->q[k] * (2 * e.nb[s][k] - e.n0[s][k]);
+        }
+        e.dct.inverse(e.stage[s].data(), *w[s], m_pool);
+    }
+    etdReactions(f, f.u, f.v, e.nc);
+
+    for(int s = 0; s < 2; s++)
+    {
+        for(size_t k = 0; k < count; k++)
+            e.stage[s][k] = c[s]->e[k] * e.state[s][k] + c[s]->f1[k] * e.n0[s][k] +
+                            2 * c[s]->f2[k] * (e.na[s][k] + e.nb[s][k]) + c[s]->f3[k] * e.nc[s][k];
+        e.dct.inverse(e.stage[s].data(), *w0[s], m_pool);
+    }
+
+    setBoundary(f.u0, f.v0);
+}
+
+// Heun-Euler pair: the Euler step w1 = w + dt F(w) goes to (u, v) and the
+// Heun step (w + w1 + dt F(w1)) / 2 to (eu, ev). Their difference
+// estimates the local error of the Euler step, dt is adapted so that it
+// stays near the tolerance and steps above it are taken again with a
+// smaller dt. The accepted Heun step replaces (u0, v0)
+template<class T>
+void Solver::adaptiveStep(Fields<T> &f)
+{
+    stageBuffers(f);
+
+    double least = DT_MIN * m_timeStep;
+    for(;;)
+    {
+        int rows = height - 2;
+        int bands = min(m_pool.size(), rows);
+        m_pool.run(bands, [this, &f, rows, bands](int band, int thread) {
+            solveRows(f, thread, f.u0, f.v0, f.u, f.v, 1 + band * rows / bands, 1 + (band + 1) * rows / bands);
+        });
+
+        setBoundary(f.u, f.v);
+
+        // a step whose error is not finite diverged and is rejected
+        double error = heunStage(f);
+        double factor = !isfinite(error) ? DT_SHRINK : error > 0 ? DT_SAFETY * sqrt(m_tolerance / error) : DT_GROW;
+        factor = min(DT_GROW, max(DT_SHRINK, factor));
+
+        // a step that cannot get any smaller is accepted anyway
+        bool accepted = error <= m_tolerance || dt <= least || dt * factor == dt;
+        if(accepted)
+        {
+            m_time += dt;
+            m_stepSize = dt;
+            f.u0.swap(f.eu); f.v0.swap(f.ev);
+            setBoundary(f.u0, f.v0);
+        }
+
+        dt = max(least, dt * factor);
+        if(accepted)
+            return;
+    }
+}
+
+// Heun corrector of the Euler predictor (u, v) of (u0, v0), written to
+// (eu, ev). Returns the largest difference with the predictor, NaN when
+// any cell is
+template<class T>
+double Solver::heunStage(Fields<T> &f)
+{
+    vector<double> errors(m_pool.size(), 0);
+
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+    m_pool.run(bands, [this, &f, &errors, rows, bands](int band, int thread) {
+        int begin = 1 + band * rows / bands, end = 1 + (band + 1) * rows / bands;
+        solveRows(f, thread, f.u, f.v, f.eu, f.ev, begin, end);
+
+        double error = errors[thread];
+        for(int i = begin; i < end; i++)
+        {
+            const T *u0 = f.u0.row(i), *v0 = f.v0.row(i), *u = f.u.row(i), *v = f.v.row(i);
+            T *eu = f.eu.row(i), *ev = f.ev.row(i);
+            for(int j = 1; j < width - 1; j++)
+            {
+                eu[j] = T(0.5) * (u0[j] + eu[j]);
+                ev[j] = T(0.5) * (v0[j] + ev[j]);
+                error = maxChange(error, (double)maxChange(fabs(eu[j] - u[j]), fabs(ev[j] - v[j])));
+            }
+        }
+        errors[thread] = error;
+    });
+
+    setBoundary(f.eu, f.ev);
+
+    double error = 0;
+    for(double e : errors)
+        error = maxChange(error, e);
+    return error;
+}
+
+// species added to the model after init() start at zero
+template<class T>
+void Solver::speciesBuffers(Fields<T> &f)
+{
+    size_t extra = speciesCount() - 2;
+    if(f.w0.size() != extra || (extra > 0 && (f.w0[0].rows != height || f.w0[0].cols != width)))
+    {
+        f.w0.assign(extra, Matrix<T>(height, width));
+        f.w = f.w0;
+    }
+}
+
+template<class T>
+void Solver::stageBuffers(Fields<T> &f)
+{
+    if(f.eu.rows != height || f.eu.cols != width)
+    {
+        f.eu = Matrix<T>(height, width);
+        f.ev = Matrix<T>(height, width);
+    }
+}
+
+// Strang splitting: half a step of reaction, a step of diffusion and
+// another half step of reaction, each stage with its own method and
+// number of substeps. The result replaces (u0, v0)
+template<class T>
+void Solver::splitStep(Fields<T> &f)
+{
+    reactionBuffers(f);
+    stageBuffers(f);
+
+    reactionStage(f, dt / 2);
+    setBoundary(f.u0, f.v0);
+
+    diffusionStage(f, dt);
+
+    reactionStage(f, dt / 2);
+    setBoundary(f.u0, f.v0);
+}
+
+// out = a + c * k on the interior cells of the rows [begin, end)
+template<class T>
+static void axpyRows(Matrix<T> &out, const Matrix<T> &a, const Matrix<T> &k, T c, int begin, int end)
+{
+    for(int i = begin; i < end; i++)
+    {
+        const T *ai = a.row(i), *ki = k.row(i);
+        T *oi = out.row(i);
+        for(int j = 1; j < a.cols - 1; j++)
+            oi[j] = ai[j] + c * ki[j];
+    }
+}
+
+// Advances (u0, v0) by h with the reaction terms only. Every cell is an
+// independent ODE, so chunks of rows go through all the substeps while
+// they are in cache. Stages live in (u, v), the RK accumulator in
+// (eu, ev) and the terms in (fu, fv)
+template<class T>
+void Solver::reactionStage(Fields<T> &f, double h)
+{
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+    T step = h / m_reactionSteps;
+
+    // without a jacobian the stiff method falls back to RK4
+    SplitReaction method = m_splitReaction;
+    if(method == SplitReactionRosenbrock && !hasJacobian())
+        method = SplitReactionRK4;
+    f.jac.resize(m_pool.size());
+
+    m_pool.run(bands, [this, &f, rows, bands, step, method](int band, int thread) {
+        FlushDenormals flush(sizeof(T) == sizeof(float));
+
+        int first = 1 + band * rows / bands, last = 1 + (band + 1) * rows / bands;
+        for(int begin = first; begin < last; begin += REACTION_CHUNK)
+        {
+            int end = min(last, begin + REACTION_CHUNK);
+            for(int s = 0; s < m_reactionSteps; s++)
+            {
+                switch(method)
+                {
+                case SplitReactionEuler:
+                    reactionTerms(f, thread, f.u0, f.v0, begin, end);
+                    axpyRows(f.u0, f.u0, f.fu, step, begin, end);
+                    axpyRows(f.v0, f.v0, f.fv, step, begin, end);
+                    break;
+
+                case SplitReactionHeun:
+                    reactionTerms(f, thread, f.u0, f.v0, begin, end);
+                    axpyRows(f.u, f.u0, f.fu, step, begin, end);
+                    axpyRows(f.v, f.v0, f.fv, step, begin, end);
+                    axpyRows(f.eu, f.u0, f.fu, step / 2, begin, end);
+                    axpyRows(f.ev, f.v0, f.fv, step / 2, begin, end);
+                    reactionTerms(f, thread, f.u, f.v, begin, end);
+                    axpyRows(f.u0, f.eu, f.fu, step / 2, begin, end);
+                    axpyRows(f.v0, f.ev, f.fv, step / 2, begin, end);
+                    break;
+
+                case SplitReactionRK4:
+                    reactionTerms(f, thread, f.u0, f.v0, begin, end);
+                    axpyRows(f.eu, f.u0, f.fu, step / 6, begin, end);
+                    axpyRows(f.ev, f.v0, f.fv, step / 6, begin, end);
+                    axpyRows(f.u, f.u0, f.fu, step / 2, begin, end);
+                    axpyRows(f.v, f.v0, f.fv, step / 2, begin, end);
+
+                    reactionTerms(f, thread, f.u, f.v, begin, end);
+                    axpyRows(f.eu, f.eu, f.fu, step / 3, begin, end);
+                    axpyRows(f.ev, f.ev, f.fv, step / 3, begin, end);
+                    axpyRows(f.u, f.u0, f.fu, step / 2, begin, end);
+                    axpyRows(f.v, f.v0, f.fv, step / 2, begin, end);
+
+                    reactionTerms(f, thread, f.u, f.v, begin, end);
+                    axpyRows(f.eu, f.eu, f.fu, step / 3, begin, end);
+                    axpyRows(f.ev, f.ev, f.fv, step / 3, begin, end);
+                    axpyRows(f.u, f.u0, f.fu, step, begin, end);
+                    axpyRows(f.v, f.v0, f.fv, step, begin, end);
+
+                    reactionTerms(f, thread, f.u, f.v, begin, end);
+                    axpyRows(f.u0, f.eu, f.fu, step / 6, begin, end);
+                    axpyRows(f.v0, f.ev, f.fv, step / 6, begin, end);
+                    break;
+
+                case SplitReactionRosenbrock:
+                    rosenbrockStep(f, thread, step, begin, end);
+                    break;
+                }
+            }
+        }
+    });
+}
+
+// One ROS2 step of (u0, v0) on the rows [begin, end),
+//   (I - gamma h J) k1 = R(w)
+//   (I - gamma h J) k2 = R(w + h k1) - 2 k1
+//   w' = w + 3/2 h k1 + 1/2 h k2
+// with the jacobian J of the reaction terms at w. The 2x2 systems are
+// inverted once per cell and step, k1 lives in (eu, ev) and the stage in
+// (u, v)
+template<class T>
+void Solver::rosenbrockStep(Fields<T> &f, int thread, T h, int begin, int end)
+{
+    int n = width - 2;
+    T gh = ROS2_GAMMA * h;
+    vector<T> &w = f.jac[thread];
+    w.resize((size_t)4 * n * (end - begin));
+
+    reactionTerms(f, thread, f.u0, f.v0, begin, end);
+
+    for(int i = begin; i < end; i++)
+    {
+        T *a = w.data() + (size_t)4 * n * (i - begin), *b = a + n, *c = b + n, *d = c + n;
+        const T **in = fieldInputs(f, thread, i, 1);
+        in[0] = f.u0.row(i) + 1;
+        in[1] = f.v0.row(i) + 1;
+        for(int k = 0; k < 4; k++)
+            m_jacobian[k].eval(in, a + k * n, n, f.stack[thread]);
+
+        const T *u0 = f.u0.row(i) + 1, *v0 = f.v0.row(i) + 1, *fu = f.fu.row(i) + 1, *fv = f.fv.row(i) + 1;
+        T *ku = f.eu.row(i) + 1, *kv = f.ev.row(i) + 1, *u = f.u.row(i) + 1, *v = f.v.row(i) + 1;
+        for(int j = 0; j < n; j++)
+        {
+            T waa = 1 - gh * a[j], wab = -gh * b[j], wba = -gh * c[j], wbb = 1 - gh * d[j];
+            T inv = 1 / (waa * wbb - wab * wba);
+            a[j] = wbb * inv; b[j] = -wab * inv;
+            c[j] = -wba * inv; d[j] = waa * inv;
+
+            ku[j] = a[j] * fu[j] + b[j] * fv[j];
+            kv[j] = c[j] * fu[j] + d[j] * fv[j];
+            u[j] = u0[j] + h * ku[j];
+            v[j] = v0[j] + h * kv[j];
+        }
+    }
+
+    reactionTerms(f, thread, f.u, f.v, begin, end);
+
+    for(int i = begin; i < end; i++)
+    {
+        const T *a = w.data() + (size_t)4 * n * (i - begin), *b = a + n, *c = b + n, *d = c + n;
+        const T *fu = f.fu.row(i) + 1, *fv = f.fv.row(i) + 1, *ku = f.eu.row(i) + 1, *kv = f.ev.row(i) + 1;
+        T *u0 = f.u0.row(i) + 1, *v0 = f.v0.row(i) + 1;
+        for(int j = 0; j < n; j++)
+        {
+            T gu = fu[j] - 2 * ku[j], gv = fv[j] - 2 * kv[j];
+            T lu = a[j] * gu + b[j] * gv, lv = c[j] * gu + d[j] * gv;
+            u0[j] += h * (T(1.5) * ku[j] + T(0.5) * lu);
+            v0[j] += h * (T(1.5) * kv[j] + T(0.5) * lv);
+        }
+    }
+}
+
+// Advances (u0, v0) by h with the diffusion only, the 9-point laplacian of
+// step(). Explicit substeps go through the row kernel with zero reaction
+// terms, implicit ones solve (1 - theta h D L) w' = (1 + (1 - theta) h D L) w
+// by multigrid
+template<class T>
+void Solver::diffusionStage(Fields<T> &f, double h)
+{
+    double step = h / m_diffusionSteps;
+    double dx = spacing();
+    double invh = 1.0f / (3 * dx * dx);
+    double theta = m_splitDiffusion == SplitDiffusionExplicit ? 0 :
+                   m_splitDiffusion == SplitDiffusionCrankNicolson ? 0.5 : 1;
+
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+
+    for(int s = 0; s < m_diffusionSteps; s++)
+    {
+        T cu = (1 - theta) * invh * du, cv = (1 - theta) * invh * dv;
+        m_pool.run(bands, [this, &f, rows, bands, cu, cv, step](int band, int thread) {
+            FlushDenormals flush(sizeof(T) == sizeof(float));
+
+            vector<T> &zero = f.ru[thread];
+            zero.assign(width, 0);
+            for(int i = 1 + band * rows / bands; i < 1 + (band + 1) * rows / bands; i++)
+            {
+                f.kernels.updateRow(f.u0.row(i-1), f.u0.row(i), f.u0.row(i+1), zero.data(), f.u.row(i), width, cu, (T)step);
+                f.kernels.updateRow(f.v0.row(i-1), f.v0.row(i), f.v0.row(i+1), zero.data(), f.v.row(i), width, cv, (T)step);
+            }
+        });
+
+        if(theta == 0)
+        {
+            setBoundary(f.u, f.v);
+            f.u0.swap(f.u); f.v0.swap(f.v);
+            continue;
+        }
+
+        f.mgU.setup(rows, width - 2, theta * step * du * invh);
+        f.mgV.setup(rows, width - 2, theta * step * dv * invh);
+        f.mgU.solve(f.u0, f.u, m_pool);
+        f.mgV.solve(f.v0, f.v, m_pool);
+    }
+}
+
+// Crank-Nicolson for the diffusion with explicit reaction terms R:
+//   (1 - theta dt D L) w' = (1 + (1 - theta) dt D L) w + dt R(w)
+// with the 9-point laplacian L of step(). The right hand side is an
+// explicit step with the diffusion scaled by 1 - theta, written to (u, v),
+// and the system is solved by multigrid starting from the current state,
+// which is already close to the solution
+template<class T>
+void Solver::implicitStep(Fields<T> &f)
+{
+    const double theta = 0.5;
+    double h = spacing();
+    double invh = 1.0f / (3 * h * h);
+
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+    m_pool.run(bands, [this, &f, rows, bands, theta](int band, int thread) {
+        solveRows(f, thread, f.u0, f.v0, f.u, f.v, 1 + band * rows / bands, 1 + (band + 1) * rows / bands, 1 - theta);
+    });
+
+    f.mgU.setup(rows, width - 2, theta * dt * du * invh);
+    f.mgV.setup(rows, width - 2, theta * dt * dv * invh);
+    f.mgU.solve(f.u0, f.u, m_pool);
+    f.mgV.solve(f.v0, f.v, m_pool);
+
+    setBoundary(f.u0, f.v0);
+}
+
+// spectra of the reaction terms of the state (u, v)
+template<class T>
+void Solver::etdReactions(Fields<T> &f, const Matrix<T> &u, const Matrix<T> &v, vector<double> *spectra)
+{
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+    m_pool.run(bands, [this, &f, &u, &v, rows, bands](int band, int thread) {
+        FlushDenormals flush(sizeof(T) == sizeof(float));
+        reactionTerms(f, thread, u, v, 1 + band * rows / bands, 1 + (band + 1) * rows / bands);
+    });
+
+    m_etd.dct.forward(f.fu, spectra[0].data(), m_pool);
+    m_etd.dct.forward(f.fv, spectra[1].data(), m_pool);
+}
+
+template<class T>
+void Solver::reactionBuffers(Fields<T> &f)
+{
+    if(f.fu.rows != height || f.fu.cols != width)
+    {
+        f.fu = Matrix<T>(height, width);
+        f.fv = Matrix<T>(height, width);
+    }
+}
+
+// reaction terms of the rows [begin, end) of (u, v), written to (fu, fv)
+template<class T>
+void Solver::reactionTerms(Fields<T> &f, int thread, const Matrix<T> &u, const Matrix<T> &v, int begin, int end)
+{
+    const vector<const double*> &p = m_reactionParams;
+
+    switch(m_reaction)
+    {
+    case ReactionGrayScott:
+    {
+        GrayScott<T> r = {(T)*p[0], (T)*p[1]};
+        ::reactionTerms(r, u.data(), v.data(), f.fu.data(), f.fv.data(), begin, end, width, u.stride);
+        return;
+    }
+    case ReactionFitzHughNagumo:
+    {
+        FitzHughNagumo<T> r = {(T)*p[0], (T)*p[1], (T)*p[2]};
+        ::reactionTerms(r, u.data(), v.data(), f.fu.data(), f.fv.data(), begin, end, width, u.stride);
+        return;
+    }
+    default:
+        break;
+    }
+
+    if(m_jit.isLoaded())
+    {
+        m_jit.react(u.data(), v.data(), f.fu.data(), f.fv.data(), begin, end, width, u.stride,
+                    m_paramValues.data(), (const void *const*)(fieldInputs(f, thread, 0, 0) + 2));
+        return;
+    }
+
+    for(int i = begin; i < end; i++)
+        reactions(f, thread, u.row(i), v.row(i), f.fu.row(i), f.fv.row(i), width, i, 0);
+}
+
+// one explicit step of the rows [begin, end) with their halo, and their
+// change when measure is set
+template<class T>
+void Solver::levelRows(Fields<T> &f, int thread, const Matrix<T> &u0, const Matrix<T> &v0,
+                       Matrix<T> &u, Matrix<T> &v, int begin, int end, bool measure)
+{
+    // one sweep: every row gets its halo and is measured while it is
+    // still in cache
+    for(int i = begin; i < end; i++)
+    {
+        solveRows(f, thread, u0, v0, u, v, i, i + 1);
+        setBoundaryRows(u, v, i, i + 1);
+        if(measure)
+            rateRows(u0, v0, u, v, i, i + 1);
+    }
+}
+
+template<class T>
+void Solver::solveRows(Fields<T> &f, int thread, const Matrix<T> &u0, const Matrix<T> &v0,
+                       Matrix<T> &u, Matrix<T> &v, int begin, int end, double scale)
+{
+    solveBlock(f, thread, u0, v0, u, v, begin, end, 1, width - 1, scale);
+}
+
+// the kernels update the interior of rows of n cells, here the rows start
+// at column left - 1 and are right - left + 2 cells long
+template<class T>
+void Solver::solveBlock(Fields<T> &f, int thread, const Matrix<T> &u0, const Matrix<T> &v0,
+                        Matrix<T> &u, Matrix<T> &v, int begin, int end, int left, int right, double scale)
+{
+    FlushDenormals flush(sizeof(T) == sizeof(float));
+
+    double h = spacing();
+    double invh = scale / (3 * h * h);
+    T cu = invh * du, cv = invh * dv;
+    int offset = left - 1, n = right - left + 2;
+
+    if(m_reaction != ReactionExpression)
+    {
+        reactionRows(u0.data() + offset, v0.data() + offset, u.data() + offset, v.data() + offset,
+                     begin, end, n, u0.stride, cu, cv);
+    }
+    else if(m_jit.isLoaded())
+    {
+        m_jit.step(u0.data() + offset, v0.data() + offset, u.data() + offset, v.data() + offset,
+                   begin, end, n, u0.stride, cu, cv, dt, m_paramValues.data(),
+                   (const void *const*)(fieldInputs(f, thread, 0, offset) + 2));
+    }
+    else
+    {
+        vector<T> &ru = f.ru[thread], &rv = f.rv[thread];
+        ru.resize(width);
+        rv.resize(width);
+
+        for(int i = begin; i < end; i++)
+        {
+            const T *urow = u0.row(i) + offset, *vrow = v0.row(i) + offset;
+            reactions(f, thread, urow, vrow, ru.data(), rv.data(), n, i, offset);
+
+            f.kernels.updateRow(u0.row(i-1) + offset, urow, u0.row(i+1) + offset, ru.data(), u.row(i) + offset, n, cu, (T)dt);
+            f.kernels.updateRow(v0.row(i-1) + offset, vrow, v0.row(i+1) + offset, rv.data(), v.row(i) + offset, n, cv, (T)dt);
+        }
+    }
+}
+
+// squared and largest change from (u0, v0) to (u, v) of the interior
+// cells of the rows [begin, end)
+template<class T>
+void Solver::rateRows(const Matrix<T> &u0, const Matrix<T> &v0, const Matrix<T> &u, const Matrix<T> &v,
+                      int begin, int end)
+{
+    for(int i = begin; i < end; i++)
+    {
+        const T *ur0 = u0.row(i), *vr0 = v0.row(i), *ur = u.row(i), *vr = v.row(i);
+        T squares = 0, change = 0;
+        for(int j = 1; j < u.cols - 1; j++)
+        {
+            T a = ur[j] - ur0[j], b = vr[j] - vr0[j];
+            squares += a * a + b * b;
+            change = maxChange(change, maxChange((T)fabs(a), (T)fabs(b)));
+        }
+        m_rowSquares[i] = squares;
+        m_rowChange[i] = change;
+    }
+}
+
+// change of every row from (u0, v0) to the current state
+template<class T>
+void Solver::measureRate(Fields<T> &f, const Matrix<T> &u0, const Matrix<T> &v0)
+{
+    int rows = height - 2;
+    int bands = min(m_pool.size(), rows);
+    m_pool.run(bands, [this, &f, &u0, &v0, rows, bands](int band, int) {
+        rateRows(u0, v0, f.u0, f.v0, 1 + band * rows / bands, 1 + (band + 1) * rows / bands);
+    });
+}
+
+// rate of change of a step of size h from the changes of the rows
+void Solver::reduceRate(double h)
+{
+    double squares = 0, change = 0;
+    for(int k = 0; k < interiorRows(); k++)
+    {
+        int i = interiorRow(k);
+        squares += m_rowSquares[i];
+        change = maxChange(change, m_rowChange[i]);
+    }
+
+    double cells = (double)interiorRows() * (width - 2);
+    m_rateMax = change / h;
+    m_rateL2 = sqrt(squares / (speciesCount() * cells)) / h;
+}
+
+double Solver::rate(RateNorm norm) const
+{
+    return norm == RateNormL2 ? m_rateL2 : m_rateMax;
+}
+
+void Solver::setSteadyTolerance(double val, RateNorm norm)
+{
+    m_steadyTolerance = max(0.0, val);
+    m_steadyNorm = norm;
+}
+
+double Solver::steadyTolerance() const
+{
+    return m_steadyTolerance;
+}
+
+RateNorm Solver::steadyNorm() const
+{
+    return m_steadyNorm;
+}
+
+// a run that diverged has no finite rate and never counts as steady
+bool Solver::isSteady() const
+{
+    double r = rate(m_steadyNorm);
+    return m_steadyTolerance > 0 && isfinite(r) && r < m_steadyTolerance;
+}
+
+// the loops have no branches and compile to vector min and max
+template<class T>
+Solver::Limits Solver::limitRows(const Matrix<T> &u, const Matrix<T> &v, int begin, int end)
+{
+    T maxu = numeric_limits<T>::lowest(), maxv = maxu;
+    T minu = numeric_limits<T>::max(), minv = minu;
+
+    for(int i = begin; i < end; i++)
+    {
+        const T *ur = u.row(i), *vr = v.row(i);
+        for(int j = 1; j < u.cols - 1; j++)
+        {
+            maxu = max(maxu, ur[j]); minu = min(minu, ur[j]);
+            maxv = max(maxv, vr[j]); minv = min(minv, vr[j]);
+        }
+    }
+
+    Limits l = {maxu, maxv, minu, minv};
+    return l;
+}
+
+template<class T>
+Solver::Limits Solver::frameLimits(Fields<T> &f)
+{
+    // per-thread partial limits, merged at the end
+    Limits none = {-numeric_limits<double>::max(), -numeric_limits<double>::max(),
+                   numeric_limits<double>::max(), numeric_limits<double>::max()};
+    vector<Limits> partial(m_pool.size(), none);
+
+    int rows = interiorRows();
+    int bands = min(m_pool.size(), rows);
+    m_pool.run(bands, [this, &f, &partial, rows, bands](int band, int thread) {
+        Limits &p = partial[thread];
+        for(int k = band * rows / bands; k < (band + 1) * rows / bands; k++)
+        {
+            int i = interiorRow(k);
+            Limits l = limitRows(f.u0, f.v0, i, i + 1);
+            p.maxu = max(p.maxu, l.maxu); p.maxv = max(p.maxv, l.maxv);
+            p.minu = min(p.minu, l.minu); p.minv = min(p.minv, l.minv);
+        }
+    });
+
+    Limits l = none;
+    for(const Limits &p : partial)
+    {
+        l.maxu = max(l.maxu, p.maxu); l.maxv = max(l.maxv, p.maxv);
+        l.minu = min(l.minu, p.minu); l.minv = min(l.minv, p.minv);
+    }
+    return l;
+}
+
+// percentiles of a regular sample of the interior cells
+template<class T>
+Solver::Limits Solver::percentileLimits(Fields<T> &f)
+{
+    int planes = m_dimensions == 3 ? width - 2 : 1;
+    double cells = (double)planes * (height - 2) * (width - 2);
+    int stride = max(1, (int)ceil(pow(cells / PERCENTILE_SAMPLES, 1.0 / m_dimensions)));
+
+    vector<double> us, vs;
+    for(int p = 0; p < planes; p += stride)
+        for(int i = 1; i < height - 1; i += stride)
+            for(int j = 1; j < width - 1; j += stride)
+            {
+                us.push_back(f.u0(fieldRow(p, i),j));
+                vs.push_back(f.v0(fieldRow(p, i),j));
+            }
+
+    size_t lo = (size_t)(m_percentile / 100 * (us.size() - 1));
+    size_t hi = us.size() - 1 - lo;
+
+    Limits l;
+    nth_element(us.begin(), us.begin() + lo, us.end()); l.minu = us[lo];
+    nth_element(us.begin(), us.begin() + hi, us.end()); l.maxu = us[hi];
+    nth_element(vs.begin(), vs.begin() + lo, vs.end()); l.minv = vs[lo];
+    nth_element(vs.begin(), vs.begin() + hi, vs.end()); l.maxv = vs[hi];
+    return l;
+}
+
+void Solver::updateLimits()
+{
+    if(!isCompiled() || width < 3 || height < 3)
+        return;
+
+    Limits l;
+    if(m_normalization == NormalizationPercentile)
+        l = m_precision == PrecisionFloat ? percentileLimits(m_float) : percentileLimits(m_double);
+    else
+        l = m_precision == PrecisionFloat ? frameLimits(m_float) : frameLimits(m_double);
+
+    // the widest range of the last frames
+    if(m_normalization == NormalizationRolling)
+    {
+        m_history.push_back(l);
+        while((int)m_history.size() > m_window)
+            m_history.pop_front();
+
+        for(const Limits &h : m_history)
+        {
+            l.maxu = max(l.maxu, h.maxu); l.maxv = max(l.maxv, h.maxv);
+            l.minu = min(l.minu, h.minu); l.minv = min(l.minv, h.minv);
+        }
+    }
+
+    maxu = l.maxu; maxv = l.maxv;
+    minu = l.minu; minv = l.minv;
+}
+
+void Solver::setNormalization(Normalization mode, int window, double percentile)
+{
+    m_normalization = mode;
+    m_window = max(1, window);
+    m_percentile = min(50.0, max(0.0, percentile));
+    m_history.clear();
+}
+
+Normalization Solver::normalization() const
+{
+    return m_normalization;
+}
+
+template<class T>
+void Solver::reactionRows(const T *u0, const T *v0, T *u, T *v, int begin, int end,
+                          int n, int stride, T cu, T cv)
+{
+    const vector<const double*> &p = m_reactionParams;
+
+    switch(m_reaction)
+    {
+    case ReactionGrayScott:
+    {
+        GrayScott<T> r = {(T)*p[0], (T)*p[1]};
+        reactionStep(r, u0, v0, u, v, begin, end, n, stride, cu, cv, (T)dt);
+        break;
+    }
+    case ReactionFitzHughNagumo:
+    {
+        FitzHughNagumo<T> r = {(T)*p[0], (T)*p[1], (T)*p[2]};
+        reactionStep(r, u0, v0, u, v, begin, end, n, stride, cu, cv, (T)dt);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Solver::setSize(int width, int height)
+{
+    if(width <= 1 || height <= 1)
+        return;
+
+    this->width = width;
+    this->height = height;
+    init();
+}
+
+void Solver::setDimensions(int val)
+{
+    if((val != 2 && val != 3) || (m_block && val == 3))
+        return;
+
+    m_dimensions = val;
+    if(width > 1)
+        init();
+}
+
+int Solver::dimensions() const
+{
+    return m_dimensions;
+}
+
+void Solver::setBlock(Block *block)
+{
+    m_block = block;
+    if(block)
+        m_dimensions = 2;
+}
+
+Block *Solver::block() const
+{
+    return m_block;
+}
+
+void Solver::setSlice(int val)
+{
+    m_slice = val;
+}
+
+int Solver::slice() const
+{
+    return m_slice;
+}
+
+void Solver::setTimeStep(double val)
+{
+    dt = val;
+    m_stepSize = val;
+    m_timeStep = val;
+}
+
+double Solver::timeStep() const
+{
+    return m_timeStep;
+}
+
+void Solver::setThreadCount(int val)
+{
+    if(val < 1)
+        val = 1;
+
+    if(val == threadCount())
+        return;
+
+    m_pool.setSize(val);
+}
+
+int Solver::threadCount() const
+{
+    return m_pool.size();
+}
+
+void Solver::setSimdLevel(SimdLevel level)
+{
+    // never go beyond what the CPU supports
+    m_simdLevel = min(level, detectSimdLevel());
+    m_double.kernels = kernels<double>(m_simdLevel);
+    m_float.kernels = kernels<float>(m_simdLevel);
+}
+
+SimdLevel Solver::simdLevel() const
+{
+    return m_simdLevel;
+}
+
+void Solver::setPrecision(Precision val)
+{
+    if(val == m_precision)
+        return;
+
+    if(val == PrecisionFloat)
+        convert(m_double, m_float);
+    else
+        convert(m_float, m_double);
+
+    m_precision = val;
+    WITH_FIELDS(sampleParams);
+    wakeTiles();
+
+    // a native kernel only handles the precision it was built for
+    buildNativeKernel();
+}
+
+Precision Solver::precision() const
+{
+    return m_precision;
+}
+
+void Solver::setIntegrator(Integrator val)
+{
+    m_integrator = val;
+}
+
+Integrator Solver::integrator() const
+{
+    return m_integrator;
+}
+
+void Solver::setBoundaryCondition(BoundaryCondition val, double u, double v)
+{
+    m_boundary = val;
+    m_boundaryU = u;
+    m_boundaryV = v;
+
+    // the halo of the current state follows right away
+    if(m_precision == PrecisionFloat)
+        refreshBoundary(m_float);
+    else
+        refreshBoundary(m_double);
+    wakeTiles();
+}
+
+BoundaryCondition Solver::boundaryCondition() const
+{
+    return m_boundary;
+}
+
+double Solver::boundaryU() const
+{
+    return m_boundaryU;
+}
+
+double Solver::boundaryV() const
+{
+    return m_boundaryV;
+}
+
+template<class T>
+void Solver::refreshBoundary(Fields<T> &f)
+{
+    if(width < 3 || height < 3)
+        return;
+
+    if(m_dimensions == 3 && f.u0.rows == width * width)
+        setVolumeBoundary(f.u0, f.v0);
+    else if(m_dimensions == 2 && f.u0.rows == height && f.u0.cols == width)
+    {
+        setBoundary(f.u0, f.v0);
+        for(Matrix<T> &w : f.w0)
+            haloRows(w, (T)0, 1, height - 1);
+    }
+}
+
+void Solver::setActiveTolerance(double val)
+{
+    m_activeTolerance = max(0.0, val);
+    wakeTiles();
+}
 
+double Solver::activeTolerance() const
+{
+    return m_activeTolerance;
 }
 
-Solver::~Solver()
+double Solver::activeFraction() const
 {
-    freeExpr();
+    if(m_activeTolerance <= 0 || m_activeRows == 0)
+        return 1;
+
+    return (double)m_activeCount / (m_activeRows * m_activeColumns);
 }
 
-void Solver::setModel(Model model)
+void Solver::setTolerance(double val)
 {
-    m_model = model;
-    compileParams();
+    m_tolerance = val;
 }
 
-void Solver::solve()
+double Solver::tolerance() const
 {
-    if(!fu_expr || !fv_expr)
-        return;
+    return m_tolerance;
+}
 
-    double h = 2.0f / (size -1);
-    double invh = 1.0f / (3 * h * h);
+double Solver::time() const
+{
+    return m_time;
+}
 
-    du = m_model.params["du"].value;
-    dv = m_model.params["dv"].value;
+double Solver::stepSize() const
+{
+    return m_stepSize;
+}
+
+void Solver::setDiffusionStage(SplitDiffusion method, int substeps)
+{
+    m_splitDiffusion = method;
+    m_diffusionSteps = max(1, substeps);
+}
+
+void Solver::setReactionStage(SplitReaction method, int substeps)
+{
+    m_splitReaction = method;
+    m_reactionSteps = max(1, substeps);
+}
+
+SplitDiffusion Solver::splitDiffusion() const
+{
+    return m_splitDiffusion;
+}
+
+int Solver::diffusionSteps() const
+{
+    return m_diffusionSteps;
+}
+
+SplitReaction Solver::splitReaction() const
+{
+    return m_splitReaction;
+}
+
+int Solver::reactionSteps() const
+{
+    return m_reactionSteps;
+}
+
+// Euler steps are stable while dt times every eigenvalue of the
+// linearized system stays in [-2, 0]. The 9-point laplacian scaled by
+// 1 / 3h^2 has its most negative eigenvalue, -4 / h^2, at the (pi, 0)
+// mode, and the reaction jacobian is bounded by its spectral radius, the
+// largest one over a sample of the current state. Integrators that treat
+// diffusion implicitly are only limited by the reaction. Complex
+// eigenvalues close to the imaginary axis need a smaller dt than the
+// radius suggests, hence the safety fraction of the auto mode
+double Solver::stableTimeStep()
+{
+    if(!isCompiled() || width < 3 || height < 3)
+        return numeric_limits<double>::infinity();
 
-    for(int i = 1; i < size - 1; i++)
+    Integrator integrator = stepIntegrator();
+    updateDiffusion();
+
+    double h = spacing();
+    double radius, growth = 0;
+    if(speciesCount() > 2)
+        radius = m_precision == PrecisionFloat ? speciesRadius(m_float) : speciesRadius(m_double);
+    else
+        radius = m_precision == PrecisionFloat ? reactionRadius(m_float, growth) : reactionRadius(m_double, growth);
+    // the 7-point laplacian of a volume has a larger spectral radius
+    double diffusion = (m_dimensions == 3 ? 12 : 4) * *max_element(m_diffusion.begin(), m_diffusion.end()) / (h * h);
+
+    // the stages of the split integrator are limited separately, the
+    // reaction advances dt / 2 per stage
+    if(integrator == IntegratorSplit)
     {
-        for(int j = 1; j < size - 1; j++)
+        double limit = numeric_limits<double>::infinity();
+        // Rosenbrock stages damp the decaying modes at any dt, but modes
+        // that grow are only followed while h times their growth rate
+        // stays below 1 / 2 gamma, well short of the pole of the ROS2
+        // stability function at 1 / gamma
+        if(m_splitReaction == SplitReactionRosenbrock && hasJacobian())
         {
-            u[i][j] =  u0[i][j] + dt * (invh * du * laplace(u0, i, j) + fu(u0[i][j], v0[i][j]));
-            v[i][j] =  v0[i][j] + dt * (invh * dv * laplace(v0, i, j) + fv(u0[i][j], v0[i][j]));
-
-            updateLimits(u[i][j], v[i][j]);
+            if(growth > 0)
+                limit = m_reactionSteps / (ROS2_GAMMA * growth);
         }
+        else if(radius > 0)
+            limit = 4 * m_reactionSteps / radius;
+        if(m_splitDiffusion == SplitDiffusionExplicit && diffusion > 0)
+            limit = min(limit, 2 * m_diffusionSteps / diffusion);
+        return limit;
+    }
+
+    if(integrator == IntegratorExplicit || integrator == IntegratorAdaptive)
+        radius += diffusion;
+
+    return radius > 0 ? 2 / radius : numeric_limits<double>::infinity();
+}
+
+void Solver::setAutoTimeStep(double fraction)
+{
+    m_autoTimeStep = max(0.0, fraction);
+}
+
+double Solver::autoTimeStep() const
+{
+    return m_autoTimeStep;
+}
+
+// largest spectral radius of the jacobian of (fu, fv), by central
+// differences on a regular sample of the interior cells. growth is set
+// to the largest real part of its eigenvalues, 0 when they all decay
+template<class T>
+double Solver::reactionRadius(Fields<T> &f, double &growth)
+{
+    // about as many samples in a volume as in a plane
+    int side = m_dimensions == 3 ? 16 : JACOBIAN_SAMPLES;
+    int stride = max(1, (max(width, height) - 2) / side);
+    int planes = m_dimensions == 3 ? width - 2 : 1;
+    int fields = f.params.size();
+    vector<double> x, y;
+    vector<vector<double>> params(fields);
+    for(int p = 0; p < planes; p += stride)
+        for(int i = 1; i < height - 1; i += stride)
+            for(int j = 1; j < width - 1; j += stride)
+            {
+                x.push_back(f.u0(fieldRow(p, i),j));
+                y.push_back(f.v0(fieldRow(p, i),j));
+                for(int k = 0; k < fields; k++)
+                    params[k].push_back(f.params[k](i,j));
+            }
+
+    // fu and fv at (x -+ e, y) and (x, y -+ e), the parameter fields at
+    // the same cells
+    int n = x.size();
+    vector<double> xs(4 * n), ys(4 * n), e(n), gu(4 * n), gv(4 * n), stack;
+    for(int k = 0; k < n; k++)
+    {
+        e[k] = 1e-6 * max(1.0, max(fabs(x[k]), fabs(y[k])));
+        xs[k] = x[k] - e[k];         ys[k] = y[k];
+        xs[n + k] = x[k] + e[k];     ys[n + k] = y[k];
+        xs[2 * n + k] = x[k];        ys[2 * n + k] = y[k] - e[k];
+        xs[3 * n + k] = x[k];        ys[3 * n + k] = y[k] + e[k];
+    }
+
+    vector<const double*> inputs = {xs.data(), ys.data()};
+    for(vector<double> &p : params)
+    {
+        p.resize(4 * n);
+        for(int b = 1; b < 4; b++)
+            copy(p.begin(), p.begin() + n, p.begin() + b * n);
+        inputs.push_back(p.data());
     }
 
-    // set boundary conditions
-    for(int i = 0; i < size; i++)
+    m_fu.eval(inputs.data(), gu.data(), 4 * n, stack);
+    m_fv.eval(inputs.data(), gv.data(), 4 * n, stack);
+
+    double radius = 0;
+    for(int k = 0; k < n; k++)
     {
-        u[i][0] = u[i][1]; u[i][size - 1] = u[i][size - 2]; u[0][i] = u[1][i]; u[size - 1][i] = u[size - 2][i];
-        v[i][0] = v[i][1]; v[i][size - 1] = v[i][size - 2]; v[0][i] = v[1][i]; v[size - 1][i] = v[size - 2][i];
+        double a = (gu[n + k] - gu[k]) / (2 * e[k]), b = (gu[3 * n + k] - gu[2 * n + k]) / (2 * e[k]);
+        double c = (gv[n + k] - gv[k]) / (2 * e[k]), d = (gv[3 * n + k] - gv[2 * n + k]) / (2 * e[k]);
+
+        // eigenvalues mid +- sqrt(disc), a complex pair of modulus
+        // sqrt(det) when disc < 0
+        double mid = (a + d) / 2, det = a * d - b * c, disc = mid * mid - det;
+        double r = disc >= 0 ? fabs(mid) + sqrt(disc) : sqrt(det);
+        double g = disc >= 0 ? mid + sqrt(disc) : mid;
+        if(isfinite(r))
+            radius = max(radius, r);
+        if(isfinite(g))
+            growth = max(growth, g);
     }
 
-    //correct();
-    u0 = u; v0 = v;
+    return radius;
 }
 
-void Solver::correct()
+// bound of the spectral radius of the jacobian of all the reaction terms
+// by its largest absolute row sum, from central differences on a regular
+// sample of the interior cells
+template<class T>
+double Solver::speciesRadius(Fields<T> &f)
 {
-    if(!fu_expr || !fv_expr)
-        return;
+    speciesBuffers(f);
 
-    vector<vector<double>> u1 = u;
-    vector<vector<double>> v1 = v;
+    int count = speciesCount();
+    int stride = max(1, (max(width, height) - 2) / JACOBIAN_SAMPLES);
+    vector<const Matrix<T>*> fields = {&f.u0, &f.v0};
+    for(const Matrix<T> &w : f.w0)
+        fields.push_back(&w);
 
-    double h = 2.0f / (size -1);
-    double invh = 1.0f / (3 * h * h);
+    // the parameter fields after the species
+    int inputCount = count + f.params.size();
+    for(const Matrix<T> &w : f.params)
+        fields.push_back(&w);
 
-    du = m_model.params["du"].value;
-    dv = m_model.params["dv"].value;
+    vector<vector<double>> x(inputCount);
+    for(int i = 1; i < height - 1; i += stride)
+        for(int j = 1; j < width - 1; j += stride)
+            for(int k = 0; k < inputCount; k++)
+                x[k].push_back((*fields[k])(i,j));
 
-    for(int i = 1; i < size - 1; i++)
+    // block 2 q of the inputs has species q moved by -e, block 2 q + 1 by +e
+    int n = x[0].size(), total = 2 * count * n;
+    vector<double> e(n);
+    for(int c = 0; c < n; c++)
     {
-        for(int j = 1; j < size - 1; j++)
-        {
-            u1[i][j] =  u0[i][j] + dt * (invh * du * 0.5 * (laplace(u0, i, j) + laplace(u, i, j)) + 0.5 * (fu(u0[i][j], v0[i][j]) + fu(u[i][j], v[i][j])));
-            v1[i][j] =  v0[i][j] + dt * (invh * dv * 0.5 * (laplace(v0, i, j) + laplace(v, i, j)) + 0.5 * (fv(u0[i][j], v0[i][j]) + fv(u[i][j], v[i][j])));
+        double scale = 1;
+        for(int k = 0; k < count; k++)
+            scale = max(scale, fabs(x[k][c]));
+        e[c] = 1e-6 * scale;
+    }
 
-            updateLimits(u1[i][j], v1[i][j]);
+    vector<vector<double>> xs(inputCount, vector<double>(total)), g(count, vector<double>(total));
+    vector<const double*> inputs;
+    for(int k = 0; k < inputCount; k++)
+    {
+        for(int b = 0; b < 2 * count; b++)
+            for(int c = 0; c < n; c++)
+                xs[k][b * n + c] = x[k][c] + (b / 2 != k ? 0 : b % 2 ? e[c] : -e[c]);
+        inputs.push_back(xs[k].data());
+    }
+
+    vector<const ExprProgram*> programs = speciesPrograms();
+    vector<double> stack;
+    for(int k = 0; k < count; k++)
+        programs[k]->eval(inputs.data(), g[k].data(), total, stack);
+
+    double radius = 0;
+    for(int c = 0; c < n; c++)
+        for(int p = 0; p < count; p++)
+        {
+            double sum = 0;
+            for(int q = 0; q < count; q++)
+                sum += fabs(g[p][(2 * q + 1) * n + c] - g[p][2 * q * n + c]) / (2 * e[c]);
+            if(isfinite(sum))
+                radius = max(radius, sum);
         }
+
+    return radius;
+}
+
+template<class S, class T>
+void Solver::convert(Fields<S> &from, Fields<T> &to)
+{
+    Matrix<S> *src[] = {&from.u0, &from.v0, &from.u, &from.v};
+    Matrix<T> *dst[] = {&to.u0, &to.v0, &to.u, &to.v};
+
+    for(int k = 0; k < 4; k++)
+    {
+        *dst[k] = Matrix<T>(src[k]->rows, src[k]->cols);
+        for(int i = 0; i < src[k]->rows; i++)
+            for(int j = 0; j < src[k]->cols; j++)
+                (*dst[k])(i,j) = (*src[k])(i,j);
+
+        *src[k] = Matrix<S>();
     }
 
-    // set boundary conditions
-    for(int i = 0; i < size; i++)
+    to.w0.resize(from.w0.size());
+    to.w.resize(from.w.size());
+    for(size_t k = 0; k < from.w0.size(); k++)
     {
-        u1[i][0] = u1[i][1]; u1[i][size - 1] = u1[i][size - 2]; u1[0][i] = u1[1][i]; u1[size - 1][i] = u1[size - 2][i];
-        v1[i][0] = v1[i][1]; v1[i][size - 1] = v1[i][size - 2]; v1[0][i] = v1[1][i]; v1[size - 1][i] = v1[size - 2][i];
+        Matrix<S> *ws[] = {&from.w0[k], &from.w[k]};
+        Matrix<T> *wt[] = {&to.w0[k], &to.w[k]};
+        for(int m = 0; m < 2; m++)
+        {
+            *wt[m] = Matrix<T>(ws[m]->rows, ws[m]->cols);
+            for(int i = 0; i < ws[m]->rows; i++)
+                for(int j = 0; j < ws[m]->cols; j++)
+                    (*wt[m])(i,j) = (*ws[m])(i,j);
+        }
     }
+    from.w0.clear();
+    from.w.clear();
+    from.params.clear();
 
-    u = u1; v = v1;
-    u0 = u1; v0 = v1;
+    from.fu = Matrix<S>();
+    from.fv = Matrix<S>();
+    from.eu = Matrix<S>();
+    from.ev = Matrix<S>();
 }
 
-void Solver::setSize(int val)
+void Solver::setNativeKernels(bool enabled)
 {
-    if(val <= 1)
+    if(enabled == m_native)
         return;
 
-    size = val;
-    init();
+    m_native = enabled;
+    buildNativeKernel();
 }
 
-void Solver::setTimeStep(double val)
+bool Solver::nativeKernels() const
 {
-    dt = val;
+    return m_native;
+}
+
+bool Solver::isNative() const
+{
+    return m_jit.isLoaded();
+}
+
+void Solver::setKernelCacheDir(const string &dir)
+{
+    m_jit.setCacheDir(dir);
+}
+
+void Solver::setParamField(const string &name, const Matrix<double> &source)
+{
+    if(source.rows > 0 && source.cols > 0)
+        m_paramFields[name] = source;
+    else
+        m_paramFields.erase(name);
+
+    // the programs read other inputs once other parameters are bound
+    if(boundParams() != m_fieldNames)
+        compileParams();
+    else
+        WITH_FIELDS(sampleParams);
+    wakeTiles();
+}
+
+void Solver::setParamRamp(const string &name, double from, double to, RampAxis axis)
+{
+    Matrix<double> source(axis == RampVertical ? 2 : 1, axis == RampVertical ? 1 : 2);
+    source(0,0) = from;
+    source(source.rows - 1,source.cols - 1) = to;
+    setParamField(name, source);
+}
+
+void Solver::clearParamFields()
+{
+    m_paramFields.clear();
+    if(!m_fieldNames.empty())
+        compileParams();
+    wakeTiles();
+}
+
+vector<string> Solver::paramFields() const
+{
+    return m_fieldNames;
+}
+
+const Matrix<double> &Solver::paramField(const string &name) const
+{
+    static const Matrix<double> none;
+    auto source = m_paramFields.find(name);
+    return source != m_paramFields.end() ? source->second : none;
+}
+
+ReactionKind Solver::reaction() const
+{
+    return m_reaction;
+}
+
+string Solver::kernelName() const
+{
+    if(!isCompiled())
+        return "none";
+    if(m_reaction != ReactionExpression)
+        return string("built-in ") + reactionName(m_reaction);
+    if(m_jit.isLoaded())
+        return "native";
+    return string("interpreter (") + simdLevelName(m_simdLevel) + ")";
+}
+
+double Solver::value(int i, int j) const
+{
+    if(m_dimensions == 3)
+        return value(i, j, m_slice >= 0 && m_slice < width ? m_slice : width / 2);
+
+    if(m_precision == PrecisionFloat)
+        return m_float.u0(i,j);
+    return m_double.u0(i,j);
+}
+
+double Solver::value(int i, int j, int k) const
+{
+    if(m_precision == PrecisionFloat)
+        return m_float.u0(k * width + i,j);
+    return m_double.u0(k * width + i,j);
 }
 
 void Solver::init()
 {
-    maxu = maxv = numeric_limits<double>::min();
-    minu = minv = numeric_limits<double>::max();
+    // volumes are cubes
+    if(m_dimensions == 3)
+        height = width;
+
+    WITH_FIELDS(init);
+    WITH_FIELDS(sampleParams);
+    m_time = 0;
+    m_rateMax = m_rateL2 = numeric_limits<double>::infinity();
+    wakeTiles();
+
+    // the model only has to be compiled again when it failed
+    if(!isCompiled())
+        compileParams();
+
+    m_history.clear();
+    updateLimits();
+}
+
+template<class T>
+void Solver::init(Fields<T> &f)
+{
+    Matrix<T> &u0 = f.u0, &v0 = f.v0;
+
+    if(m_dimensions == 3)
+    {
+        int n = width;
+        u0 = Matrix<T>(n * n, n);
+        v0 = Matrix<T>(n * n, n);
+
+        // the same spots as in a plane, as balls
+        for(int k = 0; k < n; k++)
+            for(int i = 0; i < n; i++)
+                for(int j = 0; j < n; j++)
+                {
+                    double x = -1 + i * 2.0f / (n-1);
+                    double y = -1 + j * 2.0f / (n-1);
+                    double z = -1 + k * 2.0f / (n-1);
+
+                    u0(k * n + i,j) = 1 - exp(-80 * ((x+0.05) * (x+0.05) + (y+0.02) * (y+0.02) + (z+0.03) * (z+0.03)));
+                    v0(k * n + i,j) = exp(-80 * ((x-0.05) * (x-0.05) + (y-0.02) * (y-0.02) + (z-0.03) * (z-0.03)));
+                }
+
+        setVolumeBoundary(u0, v0);
+
+        f.u = u0;
+        f.v = v0;
+        f.w0.clear();
+        f.w.clear();
+        return;
+    }
+
+    u0 = Matrix<T>(height, width);
+    v0 = Matrix<T>(height, width);
+
+    // init random, centred on the field: the width spans [-1, 1] and
+    // the rows are shifted by half the difference of the sides. A block
+    // takes the coordinates of its place in the whole field
+    int top = m_block ? m_block->top() : 0, left = m_block ? m_block->left() : 0;
+    int fieldWidth = m_block ? m_block->fieldWidth() : width;
+    int fieldHeight = m_block ? m_block->fieldHeight() : height;
+    float shift = (fieldHeight - fieldWidth) / 2.0f;
+    for(int i = 0; i < height; i++)
+    {
+        for(int j = 0; j < width; j++)
+        {
+               double x = -1 + (top + i - shift) * 2.0f / (fieldWidth-1);
+               double y = -1 + (left + j) * 2.0f / (fieldWidth-1);
+
+               u0(i,j) = 1 - exp(-80 * ((x+0.05) * (x+0.05) + (y+0.02) * (y+0.02)));
+               v0(i,j) = exp(-80 * ((x-0.05) * (x-0.05) + (y-0.02) * (y-0.02)));
+        }
+    }
+
+    setBoundary(u0, v0);
+
+    f.u = u0;
+    f.v = v0;
+
+    f.w0.clear();
+    speciesBuffers(f);
+}
+
+// the row of n cells starts at column offset of row row of the plane
+template<class T>
+void Solver::reactions(Fields<T> &f, int thread, const T *u, const T *v, T *ru, T *rv, int n,
+                       int row, int offset)
+{
+    // interior cells [1, n - 1) of one row
+    const T **in = fieldInputs(f, thread, row, offset + 1);
+    in[0] = u + 1;
+    in[1] = v + 1;
+    m_fu.eval(in, ru + 1, n - 2, f.stack[thread]);
+    m_fv.eval(in, rv + 1, n - 2, f.stack[thread]);
+}
+
+// inputs of the programs from column offset of row row of the plane on,
+// the first two are left for u and v and the parameter fields follow
+template<class T>
+const T **Solver::fieldInputs(Fields<T> &f, int thread, int row, int offset)
+{
+    vector<const T*> &in = f.inputs[thread];
+    in.resize(2 + f.params.size());
+    for(size_t k = 0; k < f.params.size(); k++)
+        in[2 + k] = f.params[k].row(row) + offset;
+    return in.data();
+}
+
+// values of the bound parameters at every cell of a plane. A block takes
+// the values of its place in the whole field
+template<class T>
+void Solver::sampleParams(Fields<T> &f)
+{
+    int top = m_block ? m_block->top() : 0, left = m_block ? m_block->left() : 0;
+    int fieldWidth = m_block ? m_block->fieldWidth() : width;
+    int fieldHeight = m_block ? m_block->fieldHeight() : height;
+
+    f.params.resize(m_fieldNames.size());
+    for(size_t k = 0; k < m_fieldNames.size(); k++)
+    {
+        const Matrix<double> &source = m_paramFields[m_fieldNames[k]];
+        double si = (source.rows - 1) / (double)max(1, fieldHeight - 1);
+        double sj = (source.cols - 1) / (double)max(1, fieldWidth - 1);
+
+        Matrix<T> &w = f.params[k];
+        w = Matrix<T>(height, width);
+        for(int i = 0; i < height; i++)
+            for(int j = 0; j < width; j++)
+                w(i,j) = interpolate(source, (top + i) * si, (left + j) * sj);
+    }
+}
+
+template<class T>
+T Solver::laplace(const Matrix<T> &w, int i, int j)
+{
+    const T *up = w.row(i-1), *mid = w.row(i), *down = w.row(i+1);
+
+    return up[j] + down[j] + mid[j-1] + mid[j+1] +
+           up[j-1] + down[j+1] + up[j+1] + down[j-1] -
+           8 * mid[j];
+}
+
+template<class T>
+void Solver::setBoundary(Matrix<T> &u, Matrix<T> &v)
+{
+    setBoundaryRows(u, v, 1, height - 1);
+}
+
+// Fills the halo of the rows [begin, end): their ghost columns, and a ghost
+// row once the row it is filled from is done. Columns go first so the
+// corners pick up fresh values instead of the stale contents of a recycled
+// buffer
+template<class T>
+void Solver::setBoundaryRows(Matrix<T> &u, Matrix<T> &v, int begin, int end)
+{
+    haloRows(u, (T)m_boundaryU, begin, end);
+    haloRows(v, (T)m_boundaryV, begin, end);
+}
 
-    u0.clear(); v0.clear();
-    u0.resize(size); v0.resize(size);
+// halo of the rows [begin, end) of one field, value is its Dirichlet value
+template<class T>
+void Solver::haloRows(Matrix<T> &w, T value, int begin, int end)
+{
+    int m = height, n = width;
+    bool first = begin <= 1 && 1 < end, last = begin <= m - 2 && m - 2 < end;
 
-    // init random
-    for(int i = 0; i < size; i++)
+    switch(haloCondition())
     {
-        u0[i].resize(size); v0[i].resize(size);
+    case BoundaryNeumann:
+        // zero flux: edges copy their inner neighbours
+        for(int i = begin; i < end; i++)
+        {
+            w(i,0) = w(i,1);
+            w(i,n - 1) = w(i,n - 2);
+        }
+        if(first)
+            copy(w.row(1), w.row(1) + n, w.row(0));
+        if(last)
+            copy(w.row(m - 2), w.row(m - 2) + n, w.row(m - 1));
+        break;
 
-        for(int j = 0; j < size; j++)
+    case BoundaryPeriodic:
+        // edges copy the cells of the opposite edge
+        for(int i = begin; i < end; i++)
         {
-               double x = -1 + i * 2.0f / (size-1);
-               double y = -1 + j * 2.0f / (size-1);
+            w(i,0) = w(i,n - 2);
+            w(i,n - 1) = w(i,1);
+        }
+        if(last)
+            copy(w.row(m - 2), w.row(m - 2) + n, w.row(0));
+        if(first)
+            copy(w.row(1), w.row(1) + n, w.row(m - 1));
+        break;
 
-               u0[i][j] = 1 - exp(-80 * ((x+0.05) * (x+0.05) + (y+0.02) * (y+0.02)));
-               v0[i][j] = exp(-80 * ((x-0.05) * (x-0.05) + (y-0.02) * (y-0.02)));
+    case BoundaryDirichlet:
+        for(int i = begin; i < end; i++)
+            w(i,0) = w(i,n - 1) = value;
+        if(first)
+            fill(w.row(0), w.row(0) + n, value);
+        if(last)
+            fill(w.row(m - 1), w.row(m - 1) + n, value);
+        break;
+    }
+}
+
+// Halo of a volume: the ghost cells of the interior planes like in a
+// plane, then the ghost planes, which include the edges and corners
+template<class T>
+void Solver::setVolumeBoundary(Matrix<T> &u, Matrix<T> &v)
+{
+    int n = width;
+    BoundaryCondition condition = haloCondition();
+    Matrix<T> *fields[] = {&u, &v};
+    T values[] = {(T)m_boundaryU, (T)m_boundaryV};
 
-               updateLimits(u0[i][j], v0[i][j]);
+    int planes = n - 2;
+    int bands = min(m_pool.size(), planes);
+    m_pool.run(bands, [&](int band, int) {
+        for(int p = 1 + band * planes / bands; p < 1 + (band + 1) * planes / bands; p++)
+            for(int k = 0; k < 2; k++)
+            {
+                Matrix<T> &w = *fields[k];
+                T value = values[k];
+                for(int i = 1; i < n - 1; i++)
+                {
+                    T *row = w.row(p * n + i);
+                    if(condition == BoundaryNeumann)
+                    {
+                        row[0] = row[1];
+                        row[n - 1] = row[n - 2];
+                    }
+                    else if(condition == BoundaryPeriodic)
+                    {
+                        row[0] = row[n - 2];
+                        row[n - 1] = row[1];
+                    }
+                    else
+                        row[0] = row[n - 1] = value;
+                }
+
+                T *first = w.row(p * n), *last = w.row(p * n + n - 1);
+                if(condition == BoundaryDirichlet)
+                {
+                    fill(first, first + n, value);
+                    fill(last, last + n, value);
+                    continue;
+                }
+                bool periodic = condition == BoundaryPeriodic;
+                copy(w.row(p * n + (periodic ? n - 2 : 1)), w.row(p * n + (periodic ? n - 2 : 1)) + n, first);
+                copy(w.row(p * n + (periodic ? 1 : n - 2)), w.row(p * n + (periodic ? 1 : n - 2)) + n, last);
+            }
+    });
+
+    for(int k = 0; k < 2; k++)
+    {
+        Matrix<T> &w = *fields[k];
+        int plane = n * w.stride;
+        T *first = w.row(0), *last = w.row((n - 1) * n);
+        if(condition == BoundaryDirichlet)
+        {
+            fill(first, first + plane, values[k]);
+            fill(last, last + plane, values[k]);
+            continue;
         }
+        bool periodic = condition == BoundaryPeriodic;
+        const T *below = w.row((periodic ? n - 2 : 1) * n), *above = w.row((periodic ? 1 : n - 2) * n);
+        copy(below, below + plane, first);
+        copy(above, above + plane, last);
     }
+}
+
+// the implicit and spectral solvers are built for zero flux
+BoundaryCondition Solver::haloCondition() const
+{
+    Integrator integrator = stepIntegrator();
+    bool stencil = integrator == IntegratorExplicit || integrator == IntegratorAdaptive ||
+                   (integrator == IntegratorSplit && m_splitDiffusion == SplitDiffusionExplicit);
+    return stencil ? m_boundary : BoundaryNeumann;
+}
+
+// the integrator solve() runs, models with more than two species, volumes
+// and blocks are only supported by explicit steps
+Integrator Solver::stepIntegrator() const
+{
+    return speciesCount() > 2 || m_dimensions == 3 || m_block ? IntegratorExplicit : m_integrator;
+}
+
+// number of rows holding interior cells: the interior rows of a plane, or
+// of all the interior planes of a volume
+int Solver::interiorRows() const
+{
+    int n = height - 2;
+    return m_dimensions == 3 ? n * n : n;
+}
+
+// field row of the interior row k
+int Solver::interiorRow(int k) const
+{
+    int n = height - 2;
+    return m_dimensions == 3 ? fieldRow(k / n, 1 + k % n) : 1 + k;
+}
+
+// field row of row i of interior plane p, row i itself in a plane
+int Solver::fieldRow(int plane, int i) const
+{
+    return m_dimensions == 3 ? (plane + 1) * height + i : i;
+}
 
-    // boundary conditions (Dirichlet)
-    for(int i = 0; i < size; i++)
+// width of a cell, the width of the field spans [-1, 1]
+double Solver::spacing() const
+{
+    return 2.0f / ((m_block ? m_block->fieldWidth() : width) - 1);
+}
+
+// du, dv and the diffusion rates of all the species from the parameters
+void Solver::updateDiffusion()
+{
+    du = m_model.params["du"].value;
+    dv = m_model.params["dv"].value;
+
+    m_diffusion.assign(1, du);
+    m_diffusion.push_back(dv);
+    for(const Species &s : m_model.species)
     {
-        u0[i][0] = u0[i][1]; u0[i][size - 1] = u0[i][size - 2]; u0[0][i] = u0[1][i]; u0[i][size - 1] = u0[i][size - 2];
-        v0[i][0] = v0[i][1]; v0[i][size - 1] = v0[i][size - 2]; v0[0][i] = v0[1][i]; v0[i][size - 1] = v0[i][size - 2];
+        auto p = m_model.params.find("d" + s.name);
+        m_diffusion.push_back(p != m_model.params.end() ? p->second.value : 0);
     }
+}
 
-    u = u0;
-    v = v0;
+int Solver::speciesCount() const
+{
+    return 2 + m_model.species.size();
+}
 
-    compileParams();
+// reaction terms of all the species in order
+vector<const ExprProgram*> Solver::speciesPrograms() const
+{
+    vector<const ExprProgram*> programs = {&m_fu, &m_fv};
+    for(const ExprProgram &p : m_species)
+        programs.push_back(&p);
+    return programs;
 }
 
-double Solver::fu(double x, double y)
+// parameters of the model that have a field bound to them, in the order
+// of the parameters
+vector<string> Solver::boundParams() const
 {
-    _x = x; _y = y;
-    return te_eval(fu_expr);
+    vector<string> names;
+    for(const auto &param : m_model.params)
+        if(m_paramFields.count(param.first))
+            names.push_back(param.first);
+    return names;
+}
 
-    //return  -x * y * y + b * (1 - x);
+// the next active step updates every tile
+void Solver::wakeTiles()
+{
+    m_activeRows = 0;
 }
 
-double Solver::fv(double x, double y)
+// same expressions, species and parameter names, the parameter values
+// may differ
+bool Solver::sameExpressions(const Model &a, const Model &b)
 {
-    _x = x; _y = y;
-    return te_eval(fv_expr);
+    if(a.fu != b.fu || a.fv != b.fv || a.params.size() != b.params.size() || a.species.size() != b.species.size())
+        return false;
+
+    map<string, Param>::const_iterator i = a.params.begin(), j = b.params.begin();
+    for(; i != a.params.end(); ++i, ++j)
+        if(i->first != j->first)
+            return false;
+
+    for(size_t k = 0; k < a.species.size(); k++)
+        if(a.species[k].name != b.species[k].name || a.species[k].f != b.species[k].f)
+            return false;
 
-    //return x * y * y - d * y;
+    return true;
 }
 
-double Solver::laplace(std::vector<std::vector<double> > &w, int i, int j)
+bool Solver::isCompiled() const
 {
-    return w[i-1][j] + w[i+1][j] + w[i][j-1] + w[i][j+1] +
-           w[i-1][j-1] + w[i+1][j+1] + w[i-1][j+1] + w[i+1][j-1] -
-           8 * w[i][j];
+    for(const ExprProgram &p : m_species)
+        if(p.isEmpty())
+            return false;
+    return !m_fu.isEmpty() && !m_fv.isEmpty();
 }
 
-void Solver::updateLimits(float x, float y)
+bool Solver::hasJacobian() const
 {
-    if(x >= maxu)
-        maxu = x;
-    if(y >= maxv)
-        maxv = y;
-    if(x <= minu)
-        minu = x;
-    if(y <= minv)
-        minv = y;
+    for(const ExprProgram &p : m_jacobian)
+        if(p.isEmpty())
+            return false;
+    return true;
 }
 
-int Solver::compileParams()
+int Solver::compileParams(const Solver *compiled)
 {
-    te_variable vars[m_model.params.size() + 2];
+    int extra = m_model.species.size();
+    te_variable vars[m_model.params.size() + 2 + extra];
+
+    m_paramAddresses.clear();
 
     int count = 0;
     map<string, Param>::iterator i = m_model.params.begin();
     while (i != m_model.params.end()) {
+        m_paramAddresses.push_back(&(i->second.value));
         vars[count].name = i->first.c_str();
         vars[count].address = &(i->second.value);
         vars[count].type = 0;
@@ -203,21 +2470,160 @@ int Solver::compileParams()
     vars[count].address = &_y;
     vars[count].type = 0;
     vars[count].context = 0x0;
+    count++;
 
     /* Compile the expression with variables. */
     freeExpr();
 
+    // the species after u and v are bound to their own names
+    vector<const double*> inputs = {&_x, &_y};
+    m_speciesValues.assign(extra, 0);
+    for(int k = 0; k < extra; k++)
+    {
+        vars[count].name = m_model.species[k].name.c_str();
+        vars[count].address = &m_speciesValues[k];
+        vars[count].type = 0;
+        vars[count].context = 0x0;
+        inputs.push_back(&m_speciesValues[k]);
+        count++;
+    }
+
+    // parameters bound to fields are read from inputs after the species
+    m_fieldNames = boundParams();
+    m_fieldAddresses.clear();
+    for(const string &name : m_fieldNames)
+        m_fieldAddresses.push_back(&m_model.params[name].value);
+    inputs.insert(inputs.end(), m_fieldAddresses.begin(), m_fieldAddresses.end());
+
     int err;
-    fu_expr = te_compile(m_model.fu.c_str(), vars, m_model.params.size() + 2, &err);
-    fv_expr = te_compile(m_model.fv.c_str(), vars, m_model.params.size() + 2, &err);
+    fu_expr = te_compile(m_model.fu.c_str(), vars, count, &err);
+    fv_expr = te_compile(m_model.fv.c_str(), vars, count, &err);
+
+    // lower the trees to batch programs, the species are recognized by
+    // address
+    m_fu.compile(fu_expr, inputs);
+    m_fv.compile(fv_expr, inputs);
+
+    m_species.resize(extra);
+    for(int k = 0; k < extra; k++)
+    {
+        m_speciesExpr.push_back(te_compile(m_model.species[k].f.c_str(), vars, count, &err));
+        m_species[k].compile(m_speciesExpr[k], inputs);
+    }
+
+    m_paramValues.resize(m_paramAddresses.size());
+    WITH_FIELDS(sampleParams);
+
+    if(compiled && compiled->m_fieldNames == m_fieldNames)
+    {
+        shareCompiled(*compiled);
+        return err;
+    }
+
+    compileJacobian(vars, count, inputs);
+
+    // stock models skip both the interpreter and the C compiler, neither
+    // of which knows about more than two species or parameter fields
+    m_reaction = ReactionExpression;
+    if(extra == 0 && m_fieldNames.empty())
+        m_reaction = detectReaction(fu_expr, fv_expr, vars, count, m_reactionParams);
+
+    buildNativeKernel();
 
     return err;
 }
 
+// Takes the jacobian, the stock model and the native kernel of a solver
+// of the same expressions, with the addresses of its parameters and
+// variables replaced by the ones of this solver
+void Solver::shareCompiled(const Solver &compiled)
+{
+    map<const double*, const double*> addresses;
+    map<string, Param>::const_iterator from = compiled.m_model.params.begin();
+    for(size_t k = 0; k < m_paramAddresses.size(); k++, ++from)
+        addresses[&from->second.value] = m_paramAddresses[k];
+    addresses[&compiled._x] = &_x;
+    addresses[&compiled._y] = &_y;
+    for(size_t k = 0; k < m_speciesValues.size(); k++)
+        addresses[&compiled.m_speciesValues[k]] = &m_speciesValues[k];
+
+    for(int k = 0; k < 4; k++)
+    {
+        m_jacobian[k] = compiled.m_jacobian[k];
+        m_jacobian[k].rebind(addresses);
+    }
+
+    m_reaction = compiled.m_reaction;
+    m_reactionParams.clear();
+    for(const double *p : compiled.m_reactionParams)
+        m_reactionParams.push_back(addresses.count(p) ? addresses[p] : p);
+
+    // the parameters are passed to every call of the kernel
+    m_jit.unload();
+    if(m_native && m_precision == compiled.m_precision && compiled.m_jit.isLoaded())
+        m_jit.share(compiled.m_jit);
+    else
+        buildNativeKernel();
+}
+
+// the derivatives come back as expressions over the same variables, and
+// are compiled like fu and fv
+void Solver::compileJacobian(const te_variable *vars, int count, const vector<const double*> &inputs)
+{
+    if(!isCompiled() || speciesCount() > 2)
+        return;
+
+    map<const double*, string> names;
+    for(int k = 0; k < count; k++)
+        names[(const double*)vars[k].address] = vars[k].name;
+
+    ExprDerivative derivative(names);
+    const te_expr *exprs[] = {fu_expr, fu_expr, fv_expr, fv_expr};
+    const double *by[] = {&_x, &_y, &_x, &_y};
+
+    for(int k = 0; k < 4; k++)
+    {
+        string text = derivative.differentiate(exprs[k], by[k]);
+        int err;
+        te_expr *expr = text.empty() ? nullptr : te_compile(text.c_str(), vars, count, &err);
+        bool ok = expr && m_jacobian[k].compile(expr, inputs);
+        te_free(expr);
+
+        if(!ok)
+        {
+            for(ExprProgram &p : m_jacobian)
+                p.clear();
+            return;
+        }
+    }
+}
+
+void Solver::buildNativeKernel()
+{
+    m_jit.unload();
+
+    if(!m_native || !isCompiled() || m_reaction != ReactionExpression || speciesCount() > 2)
+        return;
+
+    if(!m_jit.build(fu_expr, fv_expr, m_paramAddresses, &_x, &_y, m_fieldAddresses, m_precision == PrecisionFloat))
+        cerr << "native kernel not available: " << m_jit.errorString() << endl;
+}
+
 void Solver::freeExpr()
 {
+    m_jit.unload();
+    m_fu.clear();
+    m_fv.clear();
+    for(ExprProgram &p : m_jacobian)
+        p.clear();
+
     te_free(fu_expr);
     fu_expr = nullptr;
     te_free(fv_expr);
     fv_expr = nullptr;
+
+    for(te_expr *expr : m_speciesExpr)
+        te_free(expr);
+    m_speciesExpr.clear();
+    m_species.clear();
 }
@@ -2,10 +2,21 @@
 #define SOLVER_H
 
 #include <map>
+#include <deque>
 #include <vector>
 #include <string>
 
 #include "tinyexpr.h"
+#include "matrix.h"
+#include "threadpool.h"
+#include "kernels.h"
+#include "exprprogram.h"
+#include "jit.h"
+#include "reactions.h"
+#include "tridiagonal.h"
+#include "etd.h"
+#include "multigrid.h"
+#include "block.h"
 
 struct Param
 {
@@ -14,13 +25,101 @@ struct Param
     double value;
 };
 
+// species after u and v, named by the variable that stands for it in all
+// the expressions. Its diffusion rate is the parameter "d" + name
+struct Species
+{
+    std::string name;
+    std::string f;
+};
+
 struct Model
 {
     std::map<std::string, Param> params;
     std::string fu;
     std::string fv;
+    std::vector<Species> species;
+};
+
+
+enum Precision
+{
+    PrecisionDouble,
+    PrecisionFloat
 };
 
+// Explicit Euler with the 9-point laplacian, Peaceman-Rachford ADI with
+// the 5-point one (diffusion implicit, reaction explicit), exponential
+// time differencing with the 5-point laplacian diagonalized by a cosine
+// transform, Crank-Nicolson with the 9-point laplacian solved by
+// multigrid (reaction explicit), Heun with a dt adapted to the error
+// estimated against Euler, or Strang splitting of reaction and diffusion.
+// Models with more than two species, volumes and blocks always take
+// explicit steps
+enum Integrator
+{
+    IntegratorExplicit,
+    IntegratorADI,
+    IntegratorETD,
+    IntegratorImplicit,
+    IntegratorAdaptive,
+    IntegratorSplit
+};
+
+// methods of the stages of the split integrator, diffusion uses the
+// 9-point laplacian. Rosenbrock is the linearly implicit ROS2 method on
+// every cell, with the jacobian of the reaction terms differentiated
+// symbolically. It damps stiff decaying modes at any dt, growing modes
+// still limit its steps
+enum SplitDiffusion
+{
+    SplitDiffusionExplicit,
+    SplitDiffusionCrankNicolson,
+    SplitDiffusionBackwardEuler
+};
+
+enum SplitReaction
+{
+    SplitReactionEuler,
+    SplitReactionHeun,
+    SplitReactionRK4,
+    SplitReactionRosenbrock
+};
+
+// Halo of the fields: Neumann (zero flux) copies the edge cells, periodic
+// wraps around and Dirichlet holds u and v at fixed values
+enum BoundaryCondition
+{
+    BoundaryNeumann,
+    BoundaryPeriodic,
+    BoundaryDirichlet
+};
+
+// direction of a parameter ramp: across the columns, from the left edge
+// to the right one, or down the rows, from the top edge to the bottom one
+enum RampAxis
+{
+    RampHorizontal,
+    RampVertical
+};
+
+// how updateLimits() maps the fields to the color range: the extremes of
+// the current state, the widest range of the last frames, or percentiles
+// that ignore a few outlying cells
+enum Normalization
+{
+    NormalizationFrame,
+    NormalizationRolling,
+    NormalizationPercentile
+};
+
+// norm of the rate of change (u - u0) / dt over the interior cells of u
+// and v: the largest absolute value, or the root mean square
+enum RateNorm
+{
+    RateNormMax,
+    RateNormL2
+};
 
 class Solver
 {
@@ -29,27 +128,281 @@ public:
     ~Solver();
 
     void setModel(Model model);
-    void setSize(int val);
+    // model of the same expressions as the model of compiled, with other
+    // parameter values. The jacobian and the native kernel of compiled are
+    // reused instead of being derived and built again
+    void setModel(Model model, const Solver &compiled);
+    const Model &model() const;
+    // cells per row and number of rows, the ghost cells included. Cells
+    // are square, the width spans [-1, 1]
+    void setSize(int width, int height);
+    // 2 for a plane of width x height cells, 3 for a cube of width^3
+    // cells, the height is ignored. Volumes use the 7-point laplacian and
+    // models of two species
+    void setDimensions(int val);
+    int dimensions() const;
+    // the field is a block of a larger one, split between solvers that
+    // exchange the cells along their edges through block. Blocks are
+    // planes of two species, 0 runs the whole field
+    void setBlock(Block *block);
+    Block *block() const;
+    // plane of a volume shown by value(i, j), -1 for the middle one
+    void setSlice(int val);
+    int slice() const;
     void setTimeStep(double val);
+    // dt given to setTimeStep(), dt itself changes in the automatic mode
+    // and with the adaptive integrator
+    double timeStep() const;
+    void setThreadCount(int val);
+    int threadCount() const;
+    void setSimdLevel(SimdLevel level);
+    SimdLevel simdLevel() const;
+
+    // scalar type of the fields, the current state is converted
+    void setPrecision(Precision val);
+    Precision precision() const;
+
+    void setIntegrator(Integrator val);
+    Integrator integrator() const;
+
+    // largest local error of an adaptive step, dt then holds the size of
+    // the next step and changes after every one
+    void setTolerance(double val);
+    double tolerance() const;
+    // simulated time since init()
+    double time() const;
+    // size of the last step solve() took, the last accepted one of the
+    // adaptive integrator. dt given to setTimeStep() before the first step
+    double stepSize() const;
+
+    // stages of the split integrator, each step runs substeps of dt / 2
+    // of reaction, of dt of diffusion and again of dt / 2 of reaction
+    void setDiffusionStage(SplitDiffusion method, int substeps);
+    void setReactionStage(SplitReaction method, int substeps);
+    SplitDiffusion splitDiffusion() const;
+    int diffusionSteps() const;
+    SplitReaction splitReaction() const;
+    int reactionSteps() const;
+
+    // largest dt for which the steps of the current integrator stay
+    // stable on the current state, infinity when nothing bounds it
+    double stableTimeStep();
+    // before every solve() dt is set to this fraction of stableTimeStep(),
+    // 0 keeps the dt given to setTimeStep(), which is also used when
+    // stableTimeStep() finds no bound. Not used by the adaptive
+    // integrator, which controls dt itself
+    void setAutoTimeStep(double fraction);
+    double autoTimeStep() const;
+
+    // used by the integrators with an explicit laplacian, the implicit and
+    // spectral ones always have zero flux. u and v are the Dirichlet values,
+    // further species are held at 0
+    void setBoundaryCondition(BoundaryCondition val, double u = 1, double v = 0);
+    BoundaryCondition boundaryCondition() const;
+    double boundaryU() const;
+    double boundaryV() const;
+
+    // tiles of cells changing slower than this rate are not updated while
+    // their neighbours are quiet too, 0 updates every cell. Only used by
+    // the explicit integrator
+    void setActiveTolerance(double val);
+    double activeTolerance() const;
+    // fraction of the tiles updated by the last step
+    double activeFraction() const;
+
+    // rate of change of the last step of solve() in the given norm,
+    // infinite before the first step
+    double rate(RateNorm norm = RateNormMax) const;
+    // the state counts as steady once the rate of change falls below the
+    // tolerance, 0 never does. Checked after every solve(), so a batch of
+    // steps is not cut short
+    void setSteadyTolerance(double val, RateNorm norm = RateNormMax);
+    double steadyTolerance() const;
+    RateNorm steadyNorm() const;
+    bool isSteady() const;
+
+    // reaction terms compiled to machine code by the system C compiler,
+    // falls back to the interpreter when the build is not possible
+    void setNativeKernels(bool enabled);
+    bool nativeKernels() const;
+    bool isNative() const;
+    void setKernelCacheDir(const std::string &dir);
+
+    // stock model recognized from fu and fv, run by a built-in kernel
+    ReactionKind reaction() const;
+    // human readable description of the code path used by solve()
+    std::string kernelName() const;
+    // u, v and the species of the model after them
+    int speciesCount() const;
+
+    // the parameter name takes a value per cell, sampled bilinearly from
+    // source with its corner entries on the corner cells of the field. An
+    // empty source gives the parameter back its single value. Bindings
+    // are kept across models and apply to the parameters a model has, the
+    // stock kernels are not used while one does. Volumes take the same
+    // values in every plane
+    void setParamField(const std::string &name, const Matrix<double> &source);
+    // linear ramp of the parameter from one edge of the field to the other
+    void setParamRamp(const std::string &name, double from, double to, RampAxis axis);
+    void clearParamFields();
+    // parameters of the model bound to a field
+    std::vector<std::string> paramFields() const;
+    // source bound to the parameter name, empty when it has none
+    const Matrix<double> &paramField(const std::string &name) const;
 
     void init();
-    void solve();
-    void correct();
+    // advances the simulation by steps time steps
+    void solve(int steps = 1);
+
+    // current value of u at cell (i, j), of the slice of a volume
+    double value(int i, int j) const;
+    // current value of u at cell (i, j) of plane k of a volume
+    double value(int i, int j, int k) const;
 
-    int size;
+    // sets maxu, maxv, minu and minv from the current state, only needed
+    // for the frames that are drawn
+    void updateLimits();
+    // window in frames for the rolling range, percentile in percent for
+    // the lower end, the upper one is symmetric
+    void setNormalization(Normalization mode, int window = 30, double percentile = 1);
+    Normalization normalization() const;
+
+    int width, height;
     double dt, du, dv, tau, sigma, lambda, k, b, d;
 
     double maxu, maxv, minu, minv;
 
-    std::vector<std::vector<double>> u0, v0, u, v;
-
 private:
-    double fu(double x, double y);
-    double fv(double x, double y);
-    double laplace(std::vector<std::vector<double>> &w, int i, int j);
+    // simulation state in one scalar type, only the matrices of the active
+    // precision are allocated
+    template<class T>
+    struct Fields
+    {
+        // current (u0, v0) and next (u, v) fields, swapped after every step
+        Matrix<T> u0, v0, u, v;
+        Kernels<T> kernels;
+
+        // per-thread reaction terms of the row being updated
+        std::vector<std::vector<T>> ru, rv, stack;
+
+        // ADI: reaction terms of the whole field and the systems of the
+        // lines along the rows and along the columns
+        Matrix<T> fu, fv;
+        Tridiagonal<T> lineU, lineV, columnU, columnV;
+
+        // Crank-Nicolson: diffusion systems of u and v
+        Multigrid<T> mgU, mgV;
 
-    void updateLimits(float x, float y);
-    int compileParams();
+        // adaptive steps: Heun stage, split steps: RK accumulator
+        Matrix<T> eu, ev;
+
+        // Rosenbrock stages: per-thread inverses of I - gamma h J of the
+        // cells of a chunk of rows
+        std::vector<std::vector<T>> jac;
+
+        // state before the last step of solve(), for the rate of change
+        // of the integrators that do not keep it
+        Matrix<T> pu, pv;
+
+        // current and next fields of the species after u and v, one
+        // array per species, and the per-thread reaction terms of all of
+        // them for the row being updated
+        std::vector<Matrix<T>> w0, w;
+        std::vector<std::vector<T>> rw;
+
+        // values of the parameters bound to fields at every cell of a
+        // plane, in the order of m_fieldNames, and the per-thread inputs
+        // of the programs that read them
+        std::vector<Matrix<T>> params;
+        std::vector<std::vector<const T*>> inputs;
+    };
+
+    struct Limits
+    {
+        double maxu, maxv, minu, minv;
+    };
+
+
+    template<class T> void solveSteps(Fields<T> &f, int steps);
+    // measure also takes the rate of change of the step
+    template<class T> void step(Fields<T> &f, bool measure = false);
+    template<class T> void tiledSteps(Fields<T> &f, int tiles, int count, bool measure = false);
+    template<class T> void activeStep(Fields<T> &f);
+    template<class T> void blockStep(Fields<T> &f, bool measure);
+    template<class T> void blockHalo(Matrix<T> &w, T value, bool rows);
+    template<class T> void volumeStep(Fields<T> &f, bool measure);
+    template<class T> void volumeRows(Fields<T> &f, int thread, int begin, int end, bool measure);
+    template<class T> void rowTerms(Fields<T> &f, int thread, const T *u, const T *v, T *ru, T *rv, int row);
+    template<class T> void setVolumeBoundary(Matrix<T> &u, Matrix<T> &v);
+    template<class T> void speciesStep(Fields<T> &f, bool measure);
+    template<class T> void speciesRows(Fields<T> &f, int thread, int begin, int end, bool measure);
+    template<class T> double speciesRadius(Fields<T> &f);
+    template<class T> void adiStep(Fields<T> &f);
+    template<class T> void etdStep(Fields<T> &f);
+    template<class T> void implicitStep(Fields<T> &f);
+    template<class T> void adaptiveStep(Fields<T> &f);
+    template<class T> void splitStep(Fields<T> &f);
+    template<class T> void reactionStage(Fields<T> &f, double h);
+    template<class T> void diffusionStage(Fields<T> &f, double h);
+    template<class T> void rosenbrockStep(Fields<T> &f, int thread, T h, int begin, int end);
+    template<class T> double heunStage(Fields<T> &f);
+    template<class T> void stageBuffers(Fields<T> &f);
+    template<class T> void speciesBuffers(Fields<T> &f);
+    template<class T> void etdReactions(Fields<T> &f, const Matrix<T> &u, const Matrix<T> &v, std::vector<double> *spectra);
+    template<class T> void reactionBuffers(Fields<T> &f);
+    template<class T> void reactionTerms(Fields<T> &f, int thread, const Matrix<T> &u, const Matrix<T> &v, int begin, int end);
+    template<class T> void levelRows(Fields<T> &f, int thread, const Matrix<T> &u0, const Matrix<T> &v0,
+                                     Matrix<T> &u, Matrix<T> &v, int begin, int end, bool measure = false);
+    // one explicit step of the rows [begin, end), the diffusion terms are
+    // multiplied by scale
+    template<class T> void solveRows(Fields<T> &f, int thread, const Matrix<T> &u0, const Matrix<T> &v0,
+                                     Matrix<T> &u, Matrix<T> &v, int begin, int end, double scale = 1);
+    // explicit step of the cells [begin, end) x [left, right)
+    template<class T> void solveBlock(Fields<T> &f, int thread, const Matrix<T> &u0, const Matrix<T> &v0,
+                                      Matrix<T> &u, Matrix<T> &v, int begin, int end, int left, int right,
+                                      double scale = 1);
+    template<class T> void rateRows(const Matrix<T> &u0, const Matrix<T> &v0,
+                                    const Matrix<T> &u, const Matrix<T> &v, int begin, int end);
+    template<class T> void measureRate(Fields<T> &f, const Matrix<T> &u0, const Matrix<T> &v0);
+    void reduceRate(double h);
+    template<class T> static Limits limitRows(const Matrix<T> &u, const Matrix<T> &v, int begin, int end);
+    template<class T> Limits frameLimits(Fields<T> &f);
+    template<class T> Limits percentileLimits(Fields<T> &f);
+    template<class T> void reactionRows(const T *u0, const T *v0, T *u, T *v, int begin, int end,
+                                        int n, int stride, T cu, T cv);
+    template<class T> void reactions(Fields<T> &f, int thread, const T *u, const T *v, T *ru, T *rv, int n,
+                                     int row, int offset);
+    template<class T> const T **fieldInputs(Fields<T> &f, int thread, int row, int offset);
+    template<class T> void sampleParams(Fields<T> &f);
+    template<class T> double reactionRadius(Fields<T> &f, double &growth);
+    template<class T> void init(Fields<T> &f);
+
+    template<class T> static T laplace(const Matrix<T> &w, int i, int j);
+    template<class T> void setBoundary(Matrix<T> &u, Matrix<T> &v);
+    template<class T> void setBoundaryRows(Matrix<T> &u, Matrix<T> &v, int begin, int end);
+    template<class T> void haloRows(Matrix<T> &w, T value, int begin, int end);
+    template<class T> void refreshBoundary(Fields<T> &f);
+    BoundaryCondition haloCondition() const;
+    Integrator stepIntegrator() const;
+    int interiorRows() const;
+    int interiorRow(int k) const;
+    int fieldRow(int plane, int i) const;
+    double spacing() const;
+    void updateDiffusion();
+    std::vector<const ExprProgram*> speciesPrograms() const;
+    template<class S, class T> static void convert(Fields<S> &from, Fields<T> &to);
+
+    void wakeTiles();
+    bool isCompiled() const;
+    bool hasJacobian() const;
+    // compiled: solver of the same expressions to share the compiled
+    // terms with, 0 compiles everything
+    int compileParams(const Solver *compiled = 0);
+    void shareCompiled(const Solver &compiled);
+    static bool sameExpressions(const Model &a, const Model &b);
+    void compileJacobian(const te_variable *vars, int count, const std::vector<const double*> &inputs);
+    std::vector<std::string> boundParams() const;
+    void buildNativeKernel();
     void freeExpr();
 
     Model m_model;
@@ -57,6 +410,73 @@ private:
     double _x, _y;
     te_expr *fu_expr;
     te_expr *fv_expr;
+    ExprProgram m_fu, m_fv;
+    // values the species after u and v are bound to, and their reaction
+    // terms
+    std::vector<double> m_speciesValues;
+    std::vector<te_expr*> m_speciesExpr;
+    std::vector<ExprProgram> m_species;
+    // diffusion rates of all the species, set by solve()
+    std::vector<double> m_diffusion;
+    // d fu / du, d fu / dv, d fv / du and d fv / dv, empty when fu or fv
+    // cannot be differentiated
+    ExprProgram m_jacobian[4];
+
+    ReactionKind m_reaction;
+    std::vector<const double*> m_reactionParams;
+
+    bool m_native;
+    JitKernel m_jit;
+    std::vector<const double*> m_paramAddresses;
+    std::vector<double> m_paramValues;
+
+    // sources of the parameter fields by parameter name, and the
+    // parameters of the model the programs read from fields
+    std::map<std::string, Matrix<double>> m_paramFields;
+    std::vector<std::string> m_fieldNames;
+    std::vector<const double*> m_fieldAddresses;
+
+    ThreadPool m_pool;
+
+    SimdLevel m_simdLevel;
+    int m_dimensions;
+    Block *m_block;
+    int m_slice;
+    Precision m_precision;
+    Integrator m_integrator;
+    double m_tolerance;
+    double m_time;
+    double m_stepSize;
+    double m_timeStep;
+    double m_autoTimeStep;
+    SplitDiffusion m_splitDiffusion;
+    int m_diffusionSteps;
+    SplitReaction m_splitReaction;
+    int m_reactionSteps;
+    // active tiles down and across, 0 when every tile has to be updated
+    // by the next step. Tiles that changed in the last step, and tiles
+    // whose values are the same in both buffers
+    double m_activeTolerance;
+    int m_activeRows, m_activeColumns;
+    int m_activeCount;
+    std::vector<char> m_changed, m_synced;
+    // parameters, dt and diffusion rates the activity was measured with
+    std::vector<double> m_activeState;
+    BoundaryCondition m_boundary;
+    double m_boundaryU, m_boundaryV;
+    Normalization m_normalization;
+    int m_window;
+    double m_percentile;
+    std::deque<Limits> m_history;
+    // squared and largest change of every row in the last step, summed
+    // in row order so that the rate does not depend on the thread count
+    std::vector<double> m_rowSquares, m_rowChange;
+    double m_rateMax, m_rateL2;
+    double m_steadyTolerance;
+    RateNorm m_steadyNorm;
+    Etd m_etd;
+    Fields<double> m_double;
+    Fields<float> m_float;
 };
 
 #endif // SOLVER_H
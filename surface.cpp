@@ -2,6 +2,7 @@
 
 #include <limits>
 #include <cmath>
+#include <unordered_map>
 #include <QDebug>
 
 Surface::Surface()
@@ -32,6 +33,23 @@ Surface::Surface(Matrix<float> &mat)
     computeColors();
 }
 
+Surface::Surface(const std::vector<float> &volume, int n, float level)
+{
+    m_min = 0;
+    m_max = 1;
+
+    fillIsosurface(volume, n, level);
+
+    computeNormals();
+    for(size_t i = 0; i < m_vertices.size(); ++i)
+    {
+        float val = (m_vertices[i].pos[2] + 1) / 2;
+        m_vertices[i].color[0] = clamp(colormapRed(val), 0.0, 1.0);
+        m_vertices[i].color[1] = clamp(colormapGreen(val), 0.0, 1.0);
+        m_vertices[i].color[2] = clamp(colormapBlue(val), 0.0, 1.0);
+    }
+}
+
 std::vector<Vertex> &Surface::vertices()
 {
     return m_vertices;
@@ -73,8 +91,8 @@ void Surface::fillBuffers(Matrix<float> &mat)
     {
         y0 = -aspect;
         x0 = -1.0f;
-        ystep = 2.0f * aspect / (mat.cols - 1) ;
-        xstep = 2.0f / (mat.rows - 1);
+        ystep = 2.0f * aspect / (mat.rows - 1) ;
+        xstep = 2.0f / (mat.cols - 1);
     }
 
     for(int i = 0; i < mat.rows; ++i)
@@ -128,6 +146,113 @@ void Surface::fillBuffers(Matrix<float> &mat)
     }
 }
 
+// Marching tetrahedra: every cube of 8 neighbouring values is cut in 6
+// tetrahedra around its diagonal, and a tetrahedron crossed by the level
+// gets one or two triangles. Vertices on a grid edge are shared by all the
+// triangles that meet there, so the normals come out smooth
+void Surface::fillIsosurface(const std::vector<float> &volume, int n, float level)
+{
+    static const int tetrahedra[6][4] = {
+        {0, 1, 3, 7}, {0, 3, 2, 7}, {0, 2, 6, 7}, {0, 6, 4, 7}, {0, 4, 5, 7}, {0, 5, 1, 7}
+    };
+
+    std::unordered_map<unsigned long long, unsigned int> edges;
+    float step = 2.0f / (n - 1);
+
+    // index of the vertex where the level crosses the edge between points a
+    // and b, by linear interpolation
+    auto crossing = [&](int a, int b) {
+        if(a > b)
+            std::swap(a, b);
+        unsigned long long key = (unsigned long long)a * n * n * n + b;
+        auto it = edges.find(key);
+        if(it != edges.end())
+            return it->second;
+
+        float t = (level - volume[a]) / (volume[b] - volume[a]);
+        Vertex v = {};
+        int pa[] = {a % n, a / n % n, a / (n * n)}, pb[] = {b % n, b / n % n, b / (n * n)};
+        for(int c = 0; c < 3; c++)
+            v.pos[c] = -1 + step * (pa[c] + t * (pb[c] - pa[c]));
+        v.tex[0] = (v.pos[0] + 1) / 2;
+        v.tex[1] = (v.pos[1] + 1) / 2;
+
+        m_vertices.push_back(v);
+        edges[key] = m_vertices.size() - 1;
+        return (unsigned int)m_vertices.size() - 1;
+    };
+
+    // triangles face away from the side above the level
+    auto triangle = [&](unsigned int a, unsigned int b, unsigned int c, const float *towards) {
+        const float *p = m_vertices[a].pos, *q = m_vertices[b].pos, *r = m_vertices[c].pos;
+        float u[3] = {q[0] - p[0], q[1] - p[1], q[2] - p[2]};
+        float w[3] = {r[0] - p[0], r[1] - p[1], r[2] - p[2]};
+        float normal[3] = {u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]};
+        if(normal[0] * towards[0] + normal[1] * towards[1] + normal[2] * towards[2] > 0)
+            std::swap(b, c);
+
+        m_indices.push_back(a);
+        m_indices.push_back(b);
+        m_indices.push_back(c);
+    };
+
+    for(int k = 0; k < n - 1; ++k)
+        for(int i = 0; i < n - 1; ++i)
+            for(int j = 0; j < n - 1; ++j)
+            {
+                int corners[8];
+                for(int c = 0; c < 8; c++)
+                    corners[c] = ((k + (c >> 2 & 1)) * n + i + (c >> 1 & 1)) * n + j + (c & 1);
+
+                for(const int *t : tetrahedra)
+                {
+                    int in[4], out[4], ins = 0, outs = 0;
+                    for(int c = 0; c < 4; c++)
+                    {
+                        int point = corners[t[c]];
+                        if(volume[point] > level)
+                            in[ins++] = point;
+                        else
+                            out[outs++] = point;
+                    }
+                    if(ins == 0 || outs == 0)
+                        continue;
+
+                    // direction from the points below the level to the ones above
+                    float towards[3] = {0, 0, 0};
+                    for(int c = 0; c < ins; c++)
+                    {
+                        towards[0] += (in[c] % n) / (float)ins;
+                        towards[1] += (in[c] / n % n) / (float)ins;
+                        towards[2] += (in[c] / (n * n)) / (float)ins;
+                    }
+                    for(int c = 0; c < outs; c++)
+                    {
+                        towards[0] -= (out[c] % n) / (float)outs;
+                        towards[1] -= (out[c] / n % n) / (float)outs;
+                        towards[2] -= (out[c] / (n * n)) / (float)outs;
+                    }
+
+                    if(ins == 1 || outs == 1)
+                    {
+                        // one point cut off by a triangle
+                        bool alone = ins == 1;
+                        int apex = alone ? in[0] : out[0];
+                        int *others = alone ? out : in;
+                        triangle(crossing(apex, others[0]), crossing(apex, others[1]), crossing(apex, others[2]), towards);
+                    }
+                    else
+                    {
+                        // two points on each side, a quad
+                        unsigned int a = crossing(in[0], out[0]), b = crossing(in[0], out[1]);
+                        unsigned int c = crossing(in[1], out[1]), d = crossing(in[1], out[0]);
+                        triangle(a, b, c, towards);
+                        triangle(a, c, d, towards);
+                    }
+                }
+            }
+}
+
 void Surface::computeNormals()
 {
     for(size_t j = 0; j < m_indices.size(); j = j+3)
@@ -16,6 +16,9 @@ class Surface
 public:
     Surface();
     Surface(Matrix<float> &mat);
+    // isosurface at level of a volume of n^3 values in [0, 1], plane by
+    // plane, fitted in the cube [-1, 1]^3 and colored by height
+    Surface(const std::vector<float> &volume, int n, float level);
 
     std::vector<Vertex> &vertices();
     std::vector<unsigned int> &indices();
@@ -32,6 +35,7 @@ private:
     float m_min, m_max;
 
     void fillBuffers(Matrix<float> &mat);
+    void fillIsosurface(const std::vector<float> &volume, int n, float level);
     void computeNormals();
     void computeColors();
     void normalizeDepth();
@@ -0,0 +1,12 @@
+#include <cstdio>
+
+int steadyFailures();
+int ensembleFailures();
+
+int main()
+{
+    int failures = steadyFailures() + ensembleFailures();
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+# Checks of the solver that need no display, qmake && make check runs them
+
+TARGET = tst_solver
+TEMPLATE = app
+
+CONFIG += console c++11 thread testcase
+CONFIG -= qt app_bundle
+
+unix: LIBS += -ldl
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    tst_ensemble.cpp \
+    tst_steady.cpp \
+    ../ensemble.cpp \
+    ../etd.cpp \
+    ../exprderivative.cpp \
+    ../exprprogram.cpp \
+    ../fft.cpp \
+    ../jit.cpp \
+    ../kernels.cpp \
+    ../multigrid.cpp \
+    ../reactions.cpp \
+    ../solver.cpp \
+    ../threadpool.cpp \
+    ../tinyexpr.c
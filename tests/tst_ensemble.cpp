@@ -0,0 +1,76 @@
+#include "ensemble.h"
+
+#include <cstdio>
+#include <functional>
+
+// Gray-Scott with b and d changed by every member
+static Model grayScott(double b, double d)
+{
+    Model model;
+    model.params = {{"du", {0, 1, 0.00002}}, {"dv", {0, 1, 0.00001}}, {"b", {0, 1, b}}, {"d", {0, 1, d}}};
+    model.fu = "-x*y^2+b-b*x";
+    model.fv = "x*y^2-d*y";
+    return model;
+}
+
+// members of an ensemble whose prototype went through setup must end up
+// with the same cells as solvers of their own with the same settings
+static bool membersMatchSolvers(const char *name, const std::function<void(Solver&)> &setup)
+{
+    const double values[][2] = {{0.025, 0.082}, {0.03, 0.06}, {0.022, 0.075}};
+    const int members = 3, steps = 60;
+
+    Ensemble ensemble(2);
+    Solver *prototype = ensemble.prototype();
+    setup(*prototype);
+    prototype->setModel(grayScott(0.025, 0.082));
+    prototype->setSize(48, 40);
+    prototype->setTimeStep(1);
+    for(int k = 0; k < members; k++)
+        ensemble.addMember({{"b", values[k][0]}, {"d", values[k][1]}});
+    ensemble.solve(steps);
+
+    bool ok = true;
+    for(int k = 0; k < members; k++)
+    {
+        Solver s;
+        setup(s);
+        s.setModel(grayScott(values[k][0], values[k][1]));
+        s.setSize(48, 40);
+        s.setTimeStep(1);
+        s.solve(steps);
+
+        const Solver *member = ensemble.member(k);
+        int differ = 0;
+        for(int i = 0; i < s.height; i++)
+            for(int j = 0; j < s.width; j++)
+                differ += member->value(i, j) != s.value(i, j);
+        if(differ || member->time() != s.time())
+        {
+            printf("FAIL %s member %d: %d cells differ\n", name, k, differ);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int ensembleFailures()
+{
+    int failures = 0;
+    failures += !membersMatchSolvers("explicit", [](Solver &s) {
+        s.setIntegrator(IntegratorExplicit);
+    });
+    failures += !membersMatchSolvers("split stages", [](Solver &s) {
+        s.setIntegrator(IntegratorSplit);
+        s.setDiffusionStage(SplitDiffusionBackwardEuler, 2);
+        s.setReactionStage(SplitReactionRosenbrock, 3);
+    });
+    failures += !membersMatchSolvers("parameter fields", [](Solver &s) {
+        s.setParamRamp("b", 0.02, 0.04, RampHorizontal);
+    });
+    failures += !membersMatchSolvers("native kernels", [](Solver &s) {
+        s.setNativeKernels(true);
+        s.setParamRamp("d", 0.06, 0.08, RampVertical);
+    });
+    return failures;
+}
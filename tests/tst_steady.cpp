@@ -0,0 +1,45 @@
+#include "solver.h"
+
+#include <cmath>
+#include <cstdio>
+
+// Gray-Scott at a dt far beyond the stability limit, the state turns to
+// NaN after a few steps and the run must not be taken for a steady one
+static bool divergedRunIsNotSteady(Integrator integrator, Precision precision)
+{
+    Model model;
+    model.params = {{"du", {0, 1, 0.00002}}, {"dv", {0, 1, 0.00001}}, {"b", {0, 1, 0.025}}, {"d", {0, 1, 0.082}}};
+    model.fu = "-x*y^2+b-b*x";
+    model.fv = "x*y^2-d*y";
+
+    Solver s;
+    s.setThreadCount(2);
+    s.setPrecision(precision);
+    s.setIntegrator(integrator);
+    s.setModel(model);
+    s.setSize(64, 64);
+    s.setTimeStep(5);
+    s.setSteadyTolerance(1e-6);
+
+    for(int k = 0; k < 100 && std::isfinite(s.value(32, 32)); k++)
+        s.solve(10);
+    s.solve(10);
+
+    bool ok = !std::isfinite(s.value(32, 32)) && !std::isfinite(s.rate()) &&
+              !std::isfinite(s.rate(RateNormL2)) && !s.isSteady();
+    if(!ok)
+        printf("FAIL integrator %d precision %d: u %g rate %g L2 %g steady %d\n", integrator, precision,
+               s.value(32, 32), s.rate(), s.rate(RateNormL2), s.isSteady());
+    return ok;
+}
+
+int steadyFailures()
+{
+    int failures = 0;
+    for(Precision precision : {PrecisionDouble, PrecisionFloat})
+    {
+        failures += !divergedRunIsNotSteady(IntegratorExplicit, precision);
+        failures += !divergedRunIsNotSteady(IntegratorADI, precision);
+    }
+    return failures;
+}
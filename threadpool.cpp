@@ -0,0 +1,99 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int threads) :
+    m_task(nullptr), m_count(0), m_next(0), m_active(0), m_generation(0), m_quit(false)
+{
+    start(threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+}
+
+void ThreadPool::setSize(int threads)
+{
+    if(threads == size())
+        return;
+
+    stop();
+    start(threads);
+}
+
+int ThreadPool::size() const
+{
+    return m_workers.size() + 1;
+}
+
+void ThreadPool::run(int count, const Task &task)
+{
+    if(m_workers.empty() || count <= 1)
+    {
+        for(int i = 0; i < count; i++)
+            task(i, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_active = m_workers.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    execute(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_active == 0; });
+    m_task = nullptr;
+}
+
+void ThreadPool::start(int threads)
+{
+    m_quit = false;
+    for(int i = 1; i < threads; i++)
+        m_workers.push_back(std::thread(&ThreadPool::work, this, i, m_generation));
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+
+    for(std::thread &worker : m_workers)
+        worker.join();
+    m_workers.clear();
+}
+
+void ThreadPool::work(int thread, unsigned int generation)
+{
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_quit || m_generation != generation; });
+            if(m_quit)
+                return;
+            generation = m_generation;
+        }
+
+        execute(thread);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(--m_active == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::execute(int thread)
+{
+    int index;
+    while((index = m_next++) < m_count)
+        (*m_task)(index, thread);
+}
@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+// Persistent set of worker threads. run() hands out task indices to the
+// workers and to the calling thread, and returns when all of them are done.
+class ThreadPool
+{
+public:
+    // task(index, thread): thread is in [0, size()), 0 being the caller
+    typedef std::function<void(int, int)> Task;
+
+    explicit ThreadPool(int threads = 1);
+    ~ThreadPool();
+
+    void setSize(int threads);
+    int size() const;
+
+    void run(int count, const Task &task);
+
+private:
+    void start(int threads);
+    void stop();
+    void work(int thread, unsigned int generation);
+    void execute(int thread);
+
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const Task *m_task;
+    int m_count;
+    std::atomic<int> m_next;
+    int m_active;
+    unsigned int m_generation;
+    bool m_quit;
+};
+
+#endif // THREADPOOL_H
@@ -58,7 +58,7 @@ enum {
 };
 
 
-enum {TE_CONSTANT = 1};
+/* TE_CONSTANT is declared in tinyexpr.h (ALTERED for Reaction-Diffusion). */
 
 
 typedef struct state {
@@ -651,3 +651,23 @@ static void pn (const te_expr *n, int depth) {
 void te_print(const te_expr *n) {
     pn(n, 0);
 }
+
+
+/* ALTERED for Reaction-Diffusion. */
+const char *te_function_name(const void *function) {
+    const te_variable *var;
+
+    if (function == add) return "add";
+    if (function == sub) return "sub";
+    if (function == mul) return "mul";
+    if (function == divide) return "divide";
+    if (function == negate) return "negate";
+    if (function == comma) return "comma";
+    if (function == fmod) return "fmod";
+
+    for (var = functions; var->name; ++var) {
+        if (var->address == function) return var->name;
+    }
+
+    return 0;
+}
@@ -74,6 +74,17 @@ double te_eval(const te_expr *n);
 /* Prints debugging information on the syntax tree. */
 void te_print(const te_expr *n);
 
+/* ALTERED for Reaction-Diffusion: the following lets other evaluators */
+/* walk a compiled tree. */
+
+/* Node type of constants (TE_VARIABLE and TE_FUNCTIONx nodes are above). */
+enum {TE_CONSTANT = 1};
+
+/* Returns the name of a built-in function or operator ("add", "sub", */
+/* "mul", "divide", "negate", "comma", "fmod", "pow", "exp", ...), */
+/* NULL for functions that were not defined by tinyexpr. */
+const char *te_function_name(const void *function);
+
 /* Frees the expression. */
 /* This is safe to call on NULL pointers. */
 void te_free(te_expr *n);
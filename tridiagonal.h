@@ -0,0 +1,73 @@
+#ifndef TRIDIAGONAL_H
+#define TRIDIAGONAL_H
+
+#include <vector>
+
+// Constant coefficient system of the implicit diffusion lines:
+// (1 + 2a) x[k] - a (x[k-1] + x[k+1]) = d[k] for k in [1, n - 1), with zero
+// flux ends (x[0] = x[1], x[n-1] = x[n-2]). The elimination factors only
+// depend on n and a, so they are computed once per step and shared by all
+// the lines.
+template<class T>
+struct Tridiagonal
+{
+    T a;
+    // inverse pivots and back substitution factors of the elimination
+    std::vector<T> inv, up;
+
+    void factor(int n, T val)
+    {
+        a = val;
+        inv.assign(n, 0);
+        up.assign(n, 0);
+
+        T prev = 0;
+        for(int k = 1; k < n - 1; k++)
+        {
+            T diag = 1 + 2 * a;
+            if(k == 1)
+                diag -= a;
+            if(k == n - 2)
+                diag -= a;
+
+            inv[k] = 1 / (diag - a * prev);
+            up[k] = a * inv[k];
+            prev = up[k];
+        }
+    }
+
+    // solves in place one line stored contiguously
+    void solve(T *x, int n) const
+    {
+        x[1] *= inv[1];
+        for(int k = 2; k < n - 1; k++)
+            x[k] = (x[k] + a * x[k-1]) * inv[k];
+        for(int k = n - 3; k >= 1; k--)
+            x[k] += up[k] * x[k+1];
+    }
+
+    // forward elimination of row k for the lines of columns [begin, end),
+    // row holds the right hand side and prev the eliminated row k - 1.
+    // Rows are processed in order, so every line advances together and the
+    // inner loop runs along contiguous memory
+    void forward(T *row, const T *prev, int k, int begin, int end) const
+    {
+        T ak = a, ik = inv[k];
+        if(k == 1)
+            for(int j = begin; j < end; j++)
+                row[j] *= ik;
+        else
+            for(int j = begin; j < end; j++)
+                row[j] = (row[j] + ak * prev[j]) * ik;
+    }
+
+    // back substitution of row k, next is the solved row k + 1
+    void backward(T *row, const T *next, int k, int begin, int end) const
+    {
+        T uk = up[k];
+        for(int j = begin; j < end; j++)
+            row[j] += uk * next[j];
+    }
+};
+
+#endif // TRIDIAGONAL_H